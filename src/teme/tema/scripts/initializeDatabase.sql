@@ -11,6 +11,18 @@ CREATE TABLE IF NOT EXISTS Exchanges (
         rate double precision NOT NULL
 );
 
+CREATE TABLE IF NOT EXISTS ExchangeRates (
+        id int NOT NULL PRIMARY KEY,
+        source int NOT NULL references Currencies(id),
+        destination int NOT NULL references Currencies(id),
+        rate double precision NOT NULL,
+        validFrom timestamp NOT NULL,
+        UNIQUE (source, destination, validFrom)
+);
+CREATE SEQUENCE IF NOT EXISTS exchangerates_seq INCREMENT 1 START 1 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
+ALTER SEQUENCE public.exchangerates_seq OWNER TO postgres;
+ALTER TABLE exchangerates ALTER COLUMN id SET DEFAULT nextval('exchangerates_seq');
+
 CREATE TABLE IF NOT EXISTS Countries (
         id int NOT NULL PRIMARY KEY,
         name varchar(255) NOT NULL,
@@ -26,7 +38,7 @@ CREATE TABLE IF NOT EXISTS Users (
         lastname varchar(255),
         password varchar(255) NOT NULL
 );
-CREATE SEQUENCE users_seq INCREMENT 1 START 2 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
+CREATE SEQUENCE IF NOT EXISTS users_seq INCREMENT 1 START 2 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
 ALTER SEQUENCE public.users_seq OWNER TO postgres;
 ALTER TABLE users ALTER COLUMN id SET DEFAULT nextval('users_seq');
 
@@ -37,29 +49,173 @@ CREATE TABLE IF NOT EXISTS Accounts (
         iban varchar(255) NOT NULL UNIQUE,
         amount double precision NOT NULL,
         firstname varchar(255) NOT NULL,
-        lastname varchar(255) NOT NULL
+        lastname varchar(255) NOT NULL,
+        opening double precision NOT NULL
 );
-CREATE SEQUENCE accounts_seq INCREMENT 1 START 1 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
+CREATE SEQUENCE IF NOT EXISTS accounts_seq INCREMENT 1 START 1 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
 ALTER SEQUENCE public.accounts_seq OWNER TO postgres;
 ALTER TABLE accounts ALTER COLUMN id SET DEFAULT nextval('accounts_seq');
 
+DO $$
+BEGIN
+        IF (SELECT relkind FROM pg_class WHERE oid = to_regclass('transactions')) = 'r' THEN
+                ALTER TABLE transactions RENAME TO transactions_unpartitioned;
+                ALTER INDEX IF EXISTS transactions_pkey RENAME TO transactions_unpartitioned_pkey;
+                ALTER INDEX IF EXISTS transactions_inbound_index RENAME TO transactions_unpartitioned_inbound_index;
+                ALTER INDEX IF EXISTS transactions_outbound_index RENAME TO transactions_unpartitioned_outbound_index;
+        END IF;
+END
+$$;
+
 CREATE TABLE IF NOT EXISTS Transactions (
-        id int NOT NULL PRIMARY KEY,
+        id int NOT NULL,
         inbound int references Accounts(id),
         outbound int references Accounts(id),
         amount double precision NOT NULL,
-        date timestamp NOT NULL
-);
-CREATE SEQUENCE transactions_seq INCREMENT 1 START 1 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
+        date timestamp NOT NULL,
+        rate double precision NOT NULL,
+        PRIMARY KEY (id, date)
+) PARTITION BY RANGE (date);
+CREATE TABLE IF NOT EXISTS transactions_default PARTITION OF transactions DEFAULT;
+CREATE SEQUENCE IF NOT EXISTS transactions_seq INCREMENT 1 START 1 MINVALUE 1 MAXVALUE 9223372036854775807 CACHE 1;
 ALTER SEQUENCE public.transactions_seq OWNER TO postgres;
 ALTER TABLE transactions ALTER COLUMN id SET DEFAULT nextval('transactions_seq');
 
+CREATE OR REPLACE FUNCTION create_transaction_partition(day date) RETURNS text AS $$
+DECLARE
+        monthStart date := date_trunc('month', day);
+        monthEnd date := date_trunc('month', day) + interval '1 month';
+        partitionName text := 'transactions_' || to_char(day, 'YYYY_MM');
+BEGIN
+        PERFORM pg_advisory_xact_lock(hashtext('create_transaction_partition'));
+        IF to_regclass(partitionName) IS NULL THEN
+                EXECUTE format('CREATE TABLE %I (LIKE transactions INCLUDING DEFAULTS INCLUDING CONSTRAINTS)', partitionName);
+                EXECUTE format('WITH moved AS (DELETE FROM transactions_default WHERE date >= %L AND date < %L RETURNING *) INSERT INTO %I SELECT * FROM moved',
+                        monthStart, monthEnd, partitionName);
+                EXECUTE format('ALTER TABLE transactions ATTACH PARTITION %I FOR VALUES FROM (%L) TO (%L)', partitionName, monthStart, monthEnd);
+        END IF;
+        RETURN partitionName;
+END
+$$ LANGUAGE plpgsql;
+
+DO $$
+DECLARE
+        copied bigint;
+        existing bigint;
+BEGIN
+        IF to_regclass('transactions_unpartitioned') IS NOT NULL THEN
+                PERFORM create_transaction_partition(month::date)
+                FROM generate_series(
+                        (SELECT date_trunc('month', min(date)) FROM transactions_unpartitioned),
+                        (SELECT date_trunc('month', max(date)) FROM transactions_unpartitioned),
+                        interval '1 month'
+                ) AS month;
+                -- transfers whose accounts or exchange rate are missing keep a rate of 1, instead of being left behind
+                INSERT INTO transactions (id, inbound, outbound, amount, date, rate)
+                SELECT t.id, t.inbound, t.outbound, t.amount, t.date, coalesce(e.rate, 1)
+                FROM transactions_unpartitioned t
+                LEFT JOIN accounts i ON i.id = t.inbound
+                LEFT JOIN accounts o ON o.id = t.outbound
+                LEFT JOIN exchanges e ON e.source = o.currency AND e.destination = i.currency;
+                GET DIAGNOSTICS copied = ROW_COUNT;
+                SELECT count(*) INTO existing FROM transactions_unpartitioned;
+                IF copied <> existing THEN
+                        RAISE EXCEPTION 'Only % of % transactions were moved into the partitioned table', copied, existing;
+                END IF;
+                DROP TABLE transactions_unpartitioned;
+        END IF;
+END
+$$;
+SELECT create_transaction_partition(current_date);
+SELECT create_transaction_partition((current_date + interval '1 month')::date);
+CREATE INDEX IF NOT EXISTS transactions_inbound_index ON transactions (inbound);
+CREATE INDEX IF NOT EXISTS transactions_outbound_index ON transactions (outbound);
+
+ALTER TABLE transactions ADD COLUMN IF NOT EXISTS rate double precision;
+UPDATE
+        transactions t
+SET
+        rate = e.rate
+FROM
+        accounts i,
+        accounts o,
+        exchanges e
+WHERE
+        t.rate IS NULL
+        AND i.id = t.inbound
+        AND o.id = t.outbound
+        AND e.source = o.currency
+        AND e.destination = i.currency;
+ALTER TABLE transactions ALTER COLUMN rate SET NOT NULL;
+
+ALTER TABLE accounts ADD COLUMN IF NOT EXISTS opening double precision;
+UPDATE
+        accounts a
+SET
+        opening = a.amount - coalesce(
+                (
+                        SELECT sum(t.amount * t.rate)
+                        FROM transactions t
+                        WHERE t.inbound = a.id
+                ),
+                0
+        ) + coalesce(
+                (
+                        SELECT sum(t.amount)
+                        FROM transactions t
+                        WHERE t.outbound = a.id
+                ),
+                0
+        )
+WHERE
+        a.opening IS NULL;
+ALTER TABLE accounts ALTER COLUMN opening SET NOT NULL;
+
+-- balances are changed relative to their current value, so the database is what keeps them from going below zero;
+-- balances already below zero are left as they are
+DO $$
+BEGIN
+        IF NOT EXISTS (SELECT 1 FROM pg_constraint WHERE conname = 'accounts_amount_check') THEN
+                ALTER TABLE accounts ADD CONSTRAINT accounts_amount_check CHECK (amount >= 0) NOT VALID;
+        END IF;
+END
+$$;
+
+CREATE TABLE IF NOT EXISTS TransactionDailySummaries (
+        account int NOT NULL references Accounts(id) ON DELETE CASCADE,
+        day date NOT NULL,
+        inboundAmount double precision NOT NULL,
+        inboundCount int NOT NULL,
+        outboundAmount double precision NOT NULL,
+        outboundCount int NOT NULL,
+        PRIMARY KEY (account, day)
+);
+
+CREATE TABLE IF NOT EXISTS SummaryWatermarks (
+        name varchar(255) NOT NULL PRIMARY KEY,
+        lastTransaction int NOT NULL
+);
+INSERT INTO
+        summaryWatermarks (name, lastTransaction)
+VALUES
+        ('transactions', 0) ON CONFLICT DO NOTHING;
+
+DO $$
+BEGIN
+        IF NOT EXISTS (SELECT 1 FROM information_schema.columns WHERE table_name = 'transactions' AND column_name = 'summarized') THEN
+                ALTER TABLE transactions ADD COLUMN summarized boolean NOT NULL DEFAULT false;
+                UPDATE summarywatermarks SET lasttransaction = -1 WHERE name = 'transactions';
+        END IF;
+END
+$$;
+CREATE INDEX IF NOT EXISTS transactions_unsummarized_index ON transactions (id) WHERE NOT summarized;
+
 INSERT INTO
         currencies (id, name, code)
 VALUES
         (1, 'Euro', 'EUR'),
         (2, 'Romanian new leu', 'RON'),
-        (3, 'British pound sterling', 'GBP');
+        (3, 'British pound sterling', 'GBP') ON CONFLICT DO NOTHING;
 
 INSERT INTO
         exchanges (id, source, destination, rate)
@@ -72,7 +228,20 @@ VALUES
         (6, 2, 3, 0.1720),
         (7, 3, 1, 1.1683),
         (8, 3, 2, 5.8126),
-        (9, 3, 3, 1);
+        (9, 3, 3, 1) ON CONFLICT DO NOTHING;
+
+INSERT INTO
+        exchangeRates (source, destination, rate, validFrom)
+VALUES
+        (1, 1, 1, '1970-01-01 00:00:00'),
+        (1, 2, 4.9750, '1970-01-01 00:00:00'),
+        (1, 3, 0.8558, '1970-01-01 00:00:00'),
+        (2, 1, 0.2010, '1970-01-01 00:00:00'),
+        (2, 2, 1, '1970-01-01 00:00:00'),
+        (2, 3, 0.1720, '1970-01-01 00:00:00'),
+        (3, 1, 1.1683, '1970-01-01 00:00:00'),
+        (3, 2, 5.8126, '1970-01-01 00:00:00'),
+        (3, 3, 1, '1970-01-01 00:00:00') ON CONFLICT DO NOTHING;
 
 INSERT INTO
         countries (id, name, code, ibanpattern)
@@ -81,15 +250,16 @@ VALUES
         (2, 'France', 'FR', 'nnnnnnnnnncccccccccccnn'),
         (3, 'Germany', 'GR', 'nnnnnnnnnnnnnnnnnn'),
         (4, 'Italy', 'IT', 'annnnnnnnnncccccccccccc'),
-        (5, 'United Kingdom', 'GB', 'aaaannnnnnnnnnnnnn');
+        (5, 'United Kingdom', 'GB', 'aaaannnnnnnnnnnnnn') ON CONFLICT DO NOTHING;
 
 INSERT INTO
-        users (country, email, firstname, lastname, password)
+        users (id, country, email, firstname, lastname, password)
 VALUES
-        (1, 'admin@admin.com', 'admin', 'admin', 'nPQYuMQ86pZZ7D7hQfgOWwcvpFehsPbM4BTzP2aMMf8='),
-        (2, 'test@test.com', 'test', 'test', 'nPQYuMQ86pZZ7D7hQfgOWwcvpFehsPbM4BTzP2aMMf8=');
+        (1, 1, 'admin@admin.com', 'admin', 'admin', 'nPQYuMQ86pZZ7D7hQfgOWwcvpFehsPbM4BTzP2aMMf8='),
+        (2, 2, 'test@test.com', 'test', 'test', 'nPQYuMQ86pZZ7D7hQfgOWwcvpFehsPbM4BTzP2aMMf8=') ON CONFLICT DO NOTHING;
+SELECT setval('users_seq', (SELECT max(id) FROM users));
 
 INSERT INTO
-        accounts (currency, associatedUser, iban, amount, firstname, lastname)
+        accounts (currency, associatedUser, iban, amount, firstname, lastname, opening)
 VALUES
-        (1, 1, 'RO83OPPCo1JNAQ8eEheih5zI', 1000000, 'admin', 'admin');
\ No newline at end of file
+        (1, (SELECT id FROM users WHERE email = 'admin@admin.com'), 'RO83OPPCo1JNAQ8eEheih5zI', 1000000, 'admin', 'admin', 1000000) ON CONFLICT DO NOTHING;
\ No newline at end of file
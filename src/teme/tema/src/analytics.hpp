@@ -0,0 +1,131 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+
+namespace database
+{
+    // totals of an account over one month, in the account's currency
+    class MonthlyTotals
+    {
+    private:
+        string month;
+        double inbound;
+        long long inboundCount;
+        double outbound;
+        long long outboundCount;
+
+    public:
+        MonthlyTotals(string month, double inbound, long long inboundCount, double outbound, long long outboundCount)
+            : month(month), inbound(inbound), inboundCount(inboundCount), outbound(outbound), outboundCount(outboundCount) {}
+        ~MonthlyTotals() {}
+
+        const string &getMonth() const { return month; }
+        double getInbound() const { return inbound; }
+        long long getInboundCount() const { return inboundCount; }
+        double getOutbound() const { return outbound; }
+        long long getOutboundCount() const { return outboundCount; }
+        double getNet() const { return inbound - outbound; }
+
+        void add(double inboundAmount, long long inboundTransactions, double outboundAmount, long long outboundTransactions)
+        {
+            inbound += inboundAmount;
+            inboundCount += inboundTransactions;
+            outbound += outboundAmount;
+            outboundCount += outboundTransactions;
+        }
+    };
+
+    // per account per day totals, kept in the transactiondailysummaries table: every refresh folds the
+    // transactions not yet summarized into it, and monthly totals are aggregated from the daily rows;
+    // results are cached per account until one of its transactions changes. Transactions are marked as they
+    // are folded in, so one whose transfer commits after a newer one is still picked up; ids only give the
+    // order transfers started in. Refreshes and account deletes lock the watermark row first, so they run one
+    // at a time. Account deletes take their summarized transactions out of the daily totals themselves;
+    // invalidateAll sets the watermark to -1 instead, and the next refresh rebuilds the table from scratch
+    class TransactionSummary
+    {
+    public:
+        inline static const string lockQuery = "SELECT 1 FROM summarywatermarks WHERE name = 'transactions' FOR UPDATE; ";
+
+    private:
+        inline static const string refreshQuery =
+            "WITH pending AS (UPDATE transactions SET summarized = true WHERE NOT summarized RETURNING inbound, outbound, amount, rate, date), "
+            "movements AS ("
+            "SELECT t.inbound AS account, t.date::date AS day, t.amount * t.rate AS inboundamount, 1 AS inboundcount, 0.0 AS outboundamount, 0 AS outboundcount "
+            "FROM pending t "
+            "UNION ALL SELECT t.outbound, t.date::date, 0.0, 0, t.amount, 1 FROM pending t) "
+            "INSERT INTO transactiondailysummaries AS s (account, day, inboundamount, inboundcount, outboundamount, outboundcount) "
+            "SELECT account, day, sum(inboundamount), sum(inboundcount), sum(outboundamount), sum(outboundcount) FROM movements GROUP BY account, day "
+            "ON CONFLICT (account, day) DO UPDATE SET inboundamount = s.inboundamount + excluded.inboundamount, inboundcount = s.inboundcount + excluded.inboundcount, "
+            "outboundamount = s.outboundamount + excluded.outboundamount, outboundcount = s.outboundcount + excluded.outboundcount;";
+        inline static const string rebuildQuery =
+            "UPDATE transactions SET summarized = false WHERE summarized AND (SELECT lasttransaction FROM summarywatermarks WHERE name = 'transactions') < 0; "
+            "DELETE FROM transactiondailysummaries WHERE (SELECT lasttransaction FROM summarywatermarks WHERE name = 'transactions') < 0; "
+            "UPDATE summarywatermarks SET lasttransaction = 0 WHERE name = 'transactions' AND lasttransaction < 0; ";
+
+        weak_ptr<pqxx::connection> connection;
+        map<long long, vector<MonthlyTotals>> cache;
+
+        Counter &cacheHits = MetricsRegistry::getInstance().getCounter("cache.analytics.hits");
+        Counter &cacheMisses = MetricsRegistry::getInstance().getCounter("cache.analytics.misses");
+        LatencyHistogram &refreshHistogram = MetricsRegistry::getInstance().getHistogram("analytics.refresh");
+
+        void refresh()
+        {
+            ScopedTimer timer(refreshHistogram);
+            TraceSpan span("analytics", "refresh");
+            Query(connection, getRefreshQuery()).execute();
+        }
+
+    public:
+        // folds every transaction not yet summarized into the daily totals; statements that take transactions out
+        // of the table (i.e. detaching or archiving) run it first, in the same transaction, so none is lost
+        static string getRefreshQuery() { return lockQuery + rebuildQuery + refreshQuery; }
+
+        TransactionSummary(weak_ptr<pqxx::connection> connection) : connection(connection) {}
+        ~TransactionSummary() {}
+
+        bool isAvailable() const { return !connection.expired(); }
+
+        // nullptr when the account's totals are not cached
+        const vector<MonthlyTotals> *getCachedMonthlyTotals(long long accountId)
+        {
+            auto entry = cache.find(accountId);
+            if (entry == cache.end())
+            {
+                cacheMisses.add();
+                return nullptr;
+            }
+            cacheHits.add();
+            return &entry->second;
+        }
+        const vector<MonthlyTotals> &cacheMonthlyTotals(long long accountId, vector<MonthlyTotals> totals) { return cache[accountId] = move(totals); }
+
+        vector<MonthlyTotals> getMonthlyTotals(long long accountId)
+        {
+            refresh();
+            Query query(connection, "SELECT to_char(date_trunc('month', day), 'YYYY-MM'), sum(inboundamount), sum(inboundcount), sum(outboundamount), sum(outboundcount) "
+                                    "FROM transactiondailysummaries WHERE account = :account GROUP BY 1 "
+                                    "HAVING sum(inboundcount) + sum(outboundcount) > 0 ORDER BY 1;");
+            query.setParameter<long long>("account", accountId);
+            vector<MonthlyTotals> totals;
+            for (const auto &row : query.execute())
+                totals.emplace_back(row[0].as<string>(), row[1].as<double>(), row[2].as<long long>(), row[3].as<double>(), row[4].as<long long>());
+            return totals;
+        }
+
+        void invalidateAccount(long long accountId) { cache.erase(accountId); }
+        void invalidateAll()
+        {
+            cache.clear();
+            if (isAvailable())
+                Query(connection, "UPDATE summarywatermarks SET lasttransaction = -1 WHERE name = 'transactions';").execute();
+        }
+    };
+};
\ No newline at end of file
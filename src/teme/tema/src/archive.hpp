@@ -0,0 +1,381 @@
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <format>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace exception;
+using namespace std::chrono;
+
+namespace database
+{
+    class ArchivedTransaction
+    {
+    private:
+        long long id;
+        long long inboundId;
+        long long outboundId;
+        double amount;
+        double rate;
+        // seconds since the epoch
+        int64_t timestamp;
+
+    public:
+        ArchivedTransaction(long long id, long long inboundId, long long outboundId, double amount, double rate, int64_t timestamp)
+            : id(id), inboundId(inboundId), outboundId(outboundId), amount(amount), rate(rate), timestamp(timestamp) {}
+        ~ArchivedTransaction() {}
+
+        long long getId() const { return id; }
+        long long getInboundId() const { return inboundId; }
+        long long getOutboundId() const { return outboundId; }
+        double getAmount() const { return amount; }
+        double getRate() const { return rate; }
+        int64_t getTimestamp() const { return timestamp; }
+    };
+
+    // A segment file holds the transactions of one archival run, ordered by date, and is never changed once
+    // written. After a header with the row count and the first and last timestamps come the dictionaries of
+    // the account ids (sorted, delta encoded) and of the rates, then one row per transaction: the timestamp
+    // as the delta from the previous row, the id as a zigzag delta, the accounts and the rate as dictionary
+    // indexes, and the amount in cents when it is a whole number of cents, or as a raw double otherwise.
+    // Numbers are written as LEB128 varints, so a typical row takes around a dozen bytes
+    class SegmentCodec
+    {
+    private:
+        inline static const char magic[4] = {'T', 'S', 'E', 'G'};
+        inline static const uint8_t version = 1;
+
+        static void writeVarint(string &buffer, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<char>(value));
+        }
+        static void writeSigned(string &buffer, int64_t value) { writeVarint(buffer, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63)); }
+        static void writeDouble(string &buffer, double value)
+        {
+            char bytes[sizeof(double)];
+            memcpy(bytes, &value, sizeof(double));
+            buffer.append(bytes, sizeof(double));
+        }
+
+    public:
+        class Reader
+        {
+        private:
+            const string &buffer;
+            size_t position = 0;
+
+        public:
+            Reader(const string &buffer) : buffer(buffer) {}
+
+            uint64_t readVarint()
+            {
+                uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    if (position >= buffer.size())
+                        throw(ValidationException("Archive segment is truncated!"));
+                    auto byte = static_cast<uint8_t>(buffer[position++]);
+                    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                    if ((byte & 0x80) == 0)
+                        return value;
+                }
+                throw(ValidationException("Archive segment has a malformed number!"));
+            }
+            int64_t readSigned()
+            {
+                auto value = readVarint();
+                return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+            }
+            double readDouble()
+            {
+                if (position + sizeof(double) > buffer.size())
+                    throw(ValidationException("Archive segment is truncated!"));
+                double value;
+                memcpy(&value, buffer.data() + position, sizeof(double));
+                position += sizeof(double);
+                return value;
+            }
+            void readMagic()
+            {
+                if (buffer.size() < sizeof(magic) + 1 || memcmp(buffer.data(), magic, sizeof(magic)) != 0 || static_cast<uint8_t>(buffer[sizeof(magic)]) != version)
+                    throw(ValidationException("Not an archive segment!"));
+                position = sizeof(magic) + 1;
+            }
+        };
+
+        // the rows must be ordered by timestamp
+        static string encode(const vector<ArchivedTransaction> &rows)
+        {
+            vector<long long> accounts;
+            vector<double> rates;
+            for (const auto &row : rows)
+            {
+                accounts.emplace_back(row.getInboundId());
+                accounts.emplace_back(row.getOutboundId());
+                rates.emplace_back(row.getRate());
+            }
+            sort(accounts.begin(), accounts.end());
+            accounts.erase(unique(accounts.begin(), accounts.end()), accounts.end());
+            sort(rates.begin(), rates.end());
+            rates.erase(unique(rates.begin(), rates.end()), rates.end());
+            auto indexOf = [](const auto &dictionary, auto value)
+            { return static_cast<uint64_t>(lower_bound(dictionary.begin(), dictionary.end(), value) - dictionary.begin()); };
+
+            string buffer(magic, sizeof(magic));
+            buffer.push_back(static_cast<char>(version));
+            writeVarint(buffer, rows.size());
+            writeSigned(buffer, rows.empty() ? 0 : rows.front().getTimestamp());
+            writeSigned(buffer, rows.empty() ? 0 : rows.back().getTimestamp());
+
+            writeVarint(buffer, accounts.size());
+            long long previousAccount = 0;
+            for (auto account : accounts)
+            {
+                writeSigned(buffer, account - previousAccount);
+                previousAccount = account;
+            }
+            writeVarint(buffer, rates.size());
+            for (auto rate : rates)
+                writeDouble(buffer, rate);
+
+            int64_t previousTimestamp = rows.empty() ? 0 : rows.front().getTimestamp();
+            long long previousId = 0;
+            for (const auto &row : rows)
+            {
+                writeVarint(buffer, static_cast<uint64_t>(row.getTimestamp() - previousTimestamp));
+                writeSigned(buffer, row.getId() - previousId);
+                writeVarint(buffer, indexOf(accounts, row.getInboundId()));
+                writeVarint(buffer, indexOf(accounts, row.getOutboundId()));
+                writeVarint(buffer, indexOf(rates, row.getRate()));
+                auto cents = round(row.getAmount() * 100);
+                if (cents >= 0 && cents < 1e15 && cents / 100 == row.getAmount())
+                    writeVarint(buffer, static_cast<uint64_t>(cents) << 1);
+                else
+                {
+                    writeVarint(buffer, 1);
+                    writeDouble(buffer, row.getAmount());
+                }
+                previousTimestamp = row.getTimestamp();
+                previousId = row.getId();
+            }
+            return buffer;
+        }
+    };
+
+    // what is known of a segment without decoding its rows
+    class SegmentHeader
+    {
+    private:
+        string path;
+        long long rows;
+        int64_t firstTimestamp;
+        int64_t lastTimestamp;
+
+    public:
+        SegmentHeader(string path, long long rows, int64_t firstTimestamp, int64_t lastTimestamp)
+            : path(path), rows(rows), firstTimestamp(firstTimestamp), lastTimestamp(lastTimestamp) {}
+        ~SegmentHeader() {}
+
+        const string &getPath() const { return path; }
+        long long getRows() const { return rows; }
+        int64_t getFirstTimestamp() const { return firstTimestamp; }
+        int64_t getLastTimestamp() const { return lastTimestamp; }
+        uintmax_t getSize() const { return filesystem::file_size(path); }
+    };
+
+    // cold storage for old transactions, as append only segment files in a directory; the headers of the
+    // segments are read when the archive is opened, so reads only open the segments overlapping their range
+    class TransactionArchive
+    {
+    private:
+        inline static string defaultDirectory = "archive";
+        inline static const string extension = ".tseg";
+
+        string directory;
+        vector<SegmentHeader> segments;
+
+        LatencyHistogram &writeHistogram = MetricsRegistry::getInstance().getHistogram("archive.write");
+        LatencyHistogram &readHistogram = MetricsRegistry::getInstance().getHistogram("archive.read");
+
+        // waits until what was written to the file, or the entries of the directory, is on disk rather than in the
+        // page cache; Windows flushes the file when it is closed, and has no handle for a directory
+        static void syncPath(const string &path, bool isDirectory)
+        {
+#ifndef WIN32
+            int descriptor = open(path.c_str(), isDirectory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+            if (descriptor == -1)
+                throw(ValidationException("Could not open " + path + " to sync it: " + string(strerror(errno)) + "!"));
+            auto synced = fsync(descriptor);
+            auto syncError = errno;
+            close(descriptor);
+            if (synced == -1)
+                throw(ValidationException("Could not sync " + path + ": " + string(strerror(syncError)) + "!"));
+#endif
+        }
+
+        static string readFile(const string &path)
+        {
+            ifstream file(path, ios_base::in | ios_base::binary);
+            if (!file.is_open())
+                throw(ValidationException("Could not open archive segment " + path + "!"));
+            return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        }
+        // the header fits in the first bytes of the file
+        static SegmentHeader readHeader(const string &path)
+        {
+            ifstream file(path, ios_base::in | ios_base::binary);
+            if (!file.is_open())
+                throw(ValidationException("Could not open archive segment " + path + "!"));
+            string buffer(64, '\0');
+            file.read(buffer.data(), buffer.size());
+            buffer.resize(file.gcount());
+            return readHeader(path, buffer);
+        }
+        static SegmentHeader readHeader(const string &path, const string &buffer)
+        {
+            SegmentCodec::Reader reader(buffer);
+            reader.readMagic();
+            auto rows = static_cast<long long>(reader.readVarint());
+            auto firstTimestamp = reader.readSigned();
+            auto lastTimestamp = reader.readSigned();
+            return SegmentHeader(path, rows, firstTimestamp, lastTimestamp);
+        }
+
+        // calls the visitor with every row of the segment, or none if the account (unless it is -1) does not appear in it
+        static void decode(const string &buffer, long long accountId, const function<void(const ArchivedTransaction &)> &visitor)
+        {
+            SegmentCodec::Reader reader(buffer);
+            reader.readMagic();
+            auto rows = reader.readVarint();
+            auto firstTimestamp = reader.readSigned();
+            reader.readSigned();
+
+            vector<long long> accounts(reader.readVarint());
+            long long previousAccount = 0;
+            for (auto &account : accounts)
+                previousAccount = account = previousAccount + reader.readSigned();
+            if (accountId != -1 && !binary_search(accounts.begin(), accounts.end(), accountId))
+                return;
+            vector<double> rates(reader.readVarint());
+            for (auto &rate : rates)
+                rate = reader.readDouble();
+
+            int64_t timestamp = firstTimestamp;
+            long long id = 0;
+            for (uint64_t row = 0; row < rows; row++)
+            {
+                timestamp += static_cast<int64_t>(reader.readVarint());
+                id += reader.readSigned();
+                auto inbound = reader.readVarint();
+                auto outbound = reader.readVarint();
+                auto rate = reader.readVarint();
+                if (inbound >= accounts.size() || outbound >= accounts.size() || rate >= rates.size())
+                    throw(ValidationException("Archive segment has a malformed row!"));
+                auto amountTag = reader.readVarint();
+                double amount = amountTag & 1 ? reader.readDouble() : static_cast<double>(amountTag >> 1) / 100;
+                visitor(ArchivedTransaction(id, accounts[inbound], accounts[outbound], amount, rates[rate], timestamp));
+            }
+        }
+
+    public:
+        // discard drops the segments already in the directory, for storage engines that do not persist anything
+        TransactionArchive(string directory, bool discard = false) : directory(directory)
+        {
+            filesystem::create_directories(directory);
+            vector<string> paths;
+            for (const auto &entry : filesystem::directory_iterator(directory))
+                if (entry.is_regular_file() && entry.path().extension() == extension)
+                    paths.emplace_back(entry.path().string());
+            sort(paths.begin(), paths.end());
+            for (const auto &path : paths)
+            {
+                if (discard)
+                {
+                    filesystem::remove(path);
+                    continue;
+                }
+                segments.emplace_back(readHeader(path));
+            }
+        }
+        ~TransactionArchive() {}
+
+        static void setDefaultDirectory(string newDirectory) { defaultDirectory = newDirectory; }
+        static const string &getDefaultDirectory() { return defaultDirectory; }
+
+        const vector<SegmentHeader> &getSegments() const { return segments; }
+        // one past the latest archived second, 0 for an empty archive
+        int64_t getEnd() const
+        {
+            int64_t end = 0;
+            for (const auto &segment : segments)
+                end = max(end, segment.getLastTimestamp() + 1);
+            return end;
+        }
+
+        // writes the rows, ordered by timestamp, as a new segment; the file only appears under its name once
+        // it is complete, so a failed write leaves no partial segment behind, and the segment is on disk before this
+        // returns, so the rows may be deleted from the database
+        const SegmentHeader &append(vector<ArchivedTransaction> rows)
+        {
+            ScopedTimer timer(writeHistogram);
+            TraceSpan span("archive", "write");
+            sort(rows.begin(), rows.end(), [](const ArchivedTransaction &first, const ArchivedTransaction &second)
+                 { return first.getTimestamp() < second.getTimestamp() || (first.getTimestamp() == second.getTimestamp() && first.getId() < second.getId()); });
+            auto buffer = SegmentCodec::encode(rows);
+
+            auto path = (filesystem::path(directory) / std::format("segment-{:06}{}", segments.size() + 1, extension)).string();
+            auto temporaryPath = path + ".tmp";
+            {
+                ofstream file(temporaryPath, ios_base::out | ios_base::binary | ios_base::trunc);
+                file.write(buffer.data(), buffer.size());
+                file.flush();
+                if (!file.good())
+                    throw(ValidationException("Could not write archive segment " + path + "!"));
+            }
+            syncPath(temporaryPath, false);
+            filesystem::rename(temporaryPath, path);
+            syncPath(directory, true);
+            segments.emplace_back(readHeader(path, buffer));
+            info("event=archive.segment path={} rows={} bytes={}", path, rows.size(), buffer.size());
+            return segments.back();
+        }
+
+        // calls the visitor with the archived transactions of the account (every account for -1) made in [from, to)
+        void forEach(long long accountId, int64_t from, int64_t to, const function<void(const ArchivedTransaction &)> &visitor) const
+        {
+            ScopedTimer timer(readHistogram);
+            TraceSpan span("archive", "read");
+            for (const auto &segment : segments)
+            {
+                if (segment.getRows() == 0 || segment.getLastTimestamp() < from || segment.getFirstTimestamp() >= to)
+                    continue;
+                decode(readFile(segment.getPath()), accountId, [&](const ArchivedTransaction &row)
+                       {
+                           if (row.getTimestamp() >= from && row.getTimestamp() < to && (accountId == -1 || row.getInboundId() == accountId || row.getOutboundId() == accountId))
+                               visitor(row); });
+            }
+        }
+    };
+};
\ No newline at end of file
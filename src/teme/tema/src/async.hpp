@@ -0,0 +1,457 @@
+#include <deque>
+#include <tuple>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <coroutine>
+#include <exception>
+#include <string_view>
+#include <poll.h>
+#include <libpq-fe.h>
+#include <pqxx/pqxx>
+#include <spdlog/spdlog.h>
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace std::chrono;
+
+namespace database
+{
+    template <typename Type>
+    class Task;
+
+    // where a finished task hands its result (or exception) to the coroutine awaiting it
+    template <typename Type>
+    class TaskPromiseResult
+    {
+    protected:
+        optional<Type> value;
+
+    public:
+        void return_value(Type newValue) { value.emplace(move(newValue)); }
+        Type takeValue() { return move(*value); }
+    };
+    template <>
+    class TaskPromiseResult<void>
+    {
+    public:
+        void return_void() {}
+        void takeValue() {}
+    };
+
+    // a lazily started coroutine, resumed by whoever awaits it; tasks started ahead of time (see whenAll) run
+    // until their first suspension, and are then picked up by the first co_await
+    template <typename Type>
+    class Task
+    {
+    public:
+        class promise_type : public TaskPromiseResult<Type>
+        {
+        private:
+            coroutine_handle<> continuation;
+            exception_ptr error;
+
+        public:
+            class FinalAwaiter
+            {
+            public:
+                bool await_ready() const noexcept { return false; }
+                coroutine_handle<> await_suspend(coroutine_handle<promise_type> handle) noexcept
+                {
+                    auto continuation = handle.promise().continuation;
+                    return continuation ? continuation : noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+            };
+
+            Task get_return_object() { return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+            suspend_always initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() { error = current_exception(); }
+
+            void setContinuation(coroutine_handle<> newContinuation) { continuation = newContinuation; }
+            Type takeResult()
+            {
+                if (error)
+                    rethrow_exception(error);
+                return this->takeValue();
+            }
+        };
+
+    private:
+        coroutine_handle<promise_type> handle;
+        bool started = false;
+
+        explicit Task(coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    public:
+        Task(Task &&other) noexcept : handle(exchange(other.handle, nullptr)), started(other.started) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task()
+        {
+            if (handle)
+                handle.destroy();
+        }
+
+        bool isDone() const { return handle.done(); }
+        // runs the task up to its first suspension, without anything awaiting it yet
+        void start()
+        {
+            if (started)
+                return;
+            started = true;
+            handle.resume();
+        }
+        Type getResult() { return handle.promise().takeResult(); }
+
+        bool await_ready() const noexcept { return handle.done(); }
+        coroutine_handle<> await_suspend(coroutine_handle<> awaiting)
+        {
+            handle.promise().setContinuation(awaiting);
+            if (started)
+                return noop_coroutine();
+            started = true;
+            return handle;
+        }
+        Type await_resume() { return handle.promise().takeResult(); }
+
+        // waits for the task to finish, without taking its result or exception
+        class SettledAwaiter
+        {
+        private:
+            Task &task;
+
+        public:
+            SettledAwaiter(Task &task) : task(task) {}
+
+            bool await_ready() const noexcept { return task.await_ready(); }
+            coroutine_handle<> await_suspend(coroutine_handle<> awaiting) { return task.await_suspend(awaiting); }
+            void await_resume() const noexcept {}
+        };
+        SettledAwaiter settled() { return SettledAwaiter(*this); }
+    };
+
+    // starts every task before awaiting any of them, so the queries they send are in flight together; all of
+    // them are finished before the first exception, if any, is rethrown, so none is destroyed mid-flight
+    template <typename... Types>
+    Task<tuple<Types...>> whenAll(Task<Types>... tasks)
+    {
+        (tasks.start(), ...);
+        (co_await tasks.settled(), ...);
+        co_return tuple<Types...>{tasks.getResult()...};
+    }
+
+    // something the event loop waits on; getEvents is 0 while it has nothing in flight
+    class EventSource
+    {
+    public:
+        virtual ~EventSource() = default;
+
+        virtual int getDescriptor() const = 0;
+        virtual short getEvents() const = 0;
+        virtual void process(short events) = 0;
+    };
+
+    // drives the sources with work in flight until a task completes; synchronous callers, such as the CLI,
+    // run their coroutines through it, while the coroutines themselves only suspend on the sources. Like the
+    // database connection, it is used by one thread at a time
+    class EventLoop
+    {
+    private:
+        vector<EventSource *> sources;
+
+        EventLoop() {}
+
+        void poll()
+        {
+            vector<pollfd> descriptors;
+            vector<EventSource *> waiting;
+            for (auto source : sources)
+                if (auto events = source->getEvents(); events != 0)
+                {
+                    descriptors.push_back(pollfd{source->getDescriptor(), events, 0});
+                    waiting.emplace_back(source);
+                }
+            if (descriptors.empty())
+                throw(logic_error("A task is waiting, but nothing is in flight!"));
+            if (::poll(descriptors.data(), descriptors.size(), -1) == -1)
+            {
+                if (errno == EINTR)
+                    return;
+                throw(runtime_error("Could not poll the event sources: " + string(strerror(errno))));
+            }
+            for (size_t index = 0; index < descriptors.size(); index++)
+                if (descriptors[index].revents != 0)
+                    waiting[index]->process(descriptors[index].revents);
+        }
+
+    public:
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        static EventLoop &getInstance()
+        {
+            static EventLoop instance;
+            return instance;
+        }
+
+        void add(EventSource *source) { sources.emplace_back(source); }
+        void remove(EventSource *source) { erase(sources, source); }
+
+        template <typename Type>
+        Type run(Task<Type> task)
+        {
+            task.start();
+            while (!task.isDone())
+                poll();
+            return task.getResult();
+        }
+    };
+
+    // the rows of a single statement, owning the libpq result
+    class AsyncResult
+    {
+    private:
+        unique_ptr<PGresult, void (*)(PGresult *)> result;
+
+    public:
+        AsyncResult(PGresult *result) : result(result, PQclear) {}
+
+        ExecStatusType getStatus() const { return PQresultStatus(result.get()); }
+        int getRowCount() const { return PQntuples(result.get()); }
+        int getColumnCount() const { return PQnfields(result.get()); }
+        string_view getColumnName(int column) const { return PQfname(result.get(), column); }
+        string_view getValue(int row, int column) const { return string_view(PQgetvalue(result.get(), row, column), PQgetlength(result.get(), row, column)); }
+    };
+
+    // a statement with its text parameters, bound as $1, $2, ...
+    class AsyncStatement
+    {
+    private:
+        string query;
+        vector<string> parameters;
+
+    public:
+        AsyncStatement(string query, vector<string> parameters = {}) : query(move(query)), parameters(move(parameters)) {}
+
+        const string &getQuery() const { return query; }
+        const vector<string> &getParameters() const { return parameters; }
+    };
+
+    // a connection of its own, in libpq's non-blocking pipeline mode: statements are sent as they are awaited,
+    // without waiting for the ones before them, and each batch ends with a sync, so it runs as one implicit
+    // transaction and the statements of every batch in flight share the round trips
+    class AsyncConnection : public EventSource
+    {
+    private:
+        struct Batch
+        {
+            vector<AsyncStatement> statements;
+            vector<AsyncResult> results;
+            string error;
+            string errorState;
+            coroutine_handle<> awaiting;
+            steady_clock::time_point sent;
+        };
+
+        PGconn *connection = nullptr;
+        deque<unique_ptr<Batch>> inFlight;
+        bool flushing = false;
+
+        inline static LatencyHistogram &batchHistogram = MetricsRegistry::getInstance().getHistogram("query.async");
+        inline static Counter &statementCounter = MetricsRegistry::getInstance().getCounter("query.async.statements");
+
+        // the statements of a batch that could only be sent in part would run with the next batch's sync, so the
+        // connection is reset instead
+        void send(Batch &batch)
+        {
+            if (PQstatus(connection) != CONNECTION_OK)
+                reset("The asynchronous connection was lost.");
+            for (const auto &statement : batch.statements)
+            {
+                vector<const char *> values;
+                for (const auto &parameter : statement.getParameters())
+                    values.emplace_back(parameter.c_str());
+                if (PQsendQueryParams(connection, statement.getQuery().c_str(), static_cast<int>(values.size()), nullptr, values.data(), nullptr, nullptr, 0) != 1)
+                {
+                    string message = "Could not send query: " + string(PQerrorMessage(connection));
+                    reset(message);
+                    throw(pqxx::sql_error(message));
+                }
+            }
+            if (PQpipelineSync(connection) != 1)
+            {
+                string message = "Could not send pipeline sync: " + string(PQerrorMessage(connection));
+                reset(message);
+                throw(pqxx::sql_error(message));
+            }
+            statementCounter.add(batch.statements.size());
+            ThreadCounters::roundTrips += 1;
+            flush();
+        }
+        void flush()
+        {
+            auto status = PQflush(connection);
+            if (status == -1)
+            {
+                string message = "Could not flush queries: " + string(PQerrorMessage(connection));
+                reset(message);
+                throw(pqxx::sql_error(message));
+            }
+            flushing = status == 1;
+        }
+        // non-blocking, in pipeline mode
+        bool enterPipelineMode() { return PQsetnonblocking(connection, 1) == 0 && PQenterPipelineMode(connection) == 1; }
+        // the connection is lost or out of step with its batches: it is opened again, then every batch in flight
+        // fails with the message. The batches are resumed last, as they may send new ones right away
+        void reset(const string &message)
+        {
+            error("event=async.connection.failed message=\"{}\"", message);
+            auto failed = move(inFlight);
+            inFlight.clear();
+            flushing = false;
+            PQreset(connection);
+            if (PQstatus(connection) != CONNECTION_OK || !enterPipelineMode())
+                error("event=async.connection.reset.failed message=\"{}\"", string(PQerrorMessage(connection)));
+            else
+                info("Asynchronous database connection reopened.");
+            for (auto &batch : failed)
+            {
+                batch->error = message;
+                batch->awaiting.resume();
+            }
+        }
+        // hands out the results that have arrived, in the order the batches were sent
+        void collect()
+        {
+            while (!inFlight.empty() && !PQisBusy(connection))
+            {
+                auto *result = PQgetResult(connection);
+                // the end of the results of one statement
+                if (result == nullptr)
+                    continue;
+                auto &batch = *inFlight.front();
+                AsyncResult asyncResult(result);
+                auto status = asyncResult.getStatus();
+                if (status == PGRES_PIPELINE_SYNC)
+                {
+                    auto finished = move(inFlight.front());
+                    inFlight.pop_front();
+                    batchHistogram.record(steady_clock::now() - finished->sent);
+                    finished->awaiting.resume();
+                    continue;
+                }
+                if (status == PGRES_FATAL_ERROR && batch.error.empty())
+                {
+                    batch.error = PQresultErrorMessage(result);
+                    auto state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+                    batch.errorState = state == nullptr ? "" : state;
+                }
+                batch.results.emplace_back(move(asyncResult));
+            }
+        }
+
+    public:
+        class BatchAwaiter
+        {
+        private:
+            AsyncConnection &connection;
+            unique_ptr<Batch> batch;
+            Batch *pending;
+
+        public:
+            BatchAwaiter(AsyncConnection &connection, vector<AsyncStatement> statements) : connection(connection), batch(make_unique<Batch>()), pending(batch.get())
+            {
+                batch->statements = move(statements);
+            }
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(coroutine_handle<> awaiting)
+            {
+                batch->awaiting = awaiting;
+                batch->sent = steady_clock::now();
+                connection.send(*batch);
+                // the batch outlives the awaiter's move into the queue, and is handed back on resumption
+                connection.inFlight.emplace_back(move(batch));
+            }
+            vector<AsyncResult> await_resume()
+            {
+                if (!pending->error.empty())
+                    throw(pqxx::sql_error(pending->error, "", pending->errorState.empty() ? nullptr : pending->errorState.c_str()));
+                return move(pending->results);
+            }
+        };
+
+        AsyncConnection(const string &connectionString)
+        {
+            connection = PQconnectdb(connectionString.c_str());
+            if (PQstatus(connection) != CONNECTION_OK)
+            {
+                string message = PQerrorMessage(connection);
+                PQfinish(connection);
+                throw(pqxx::sql_error("Could not open the asynchronous connection: " + message));
+            }
+            if (!enterPipelineMode())
+            {
+                string message = PQerrorMessage(connection);
+                PQfinish(connection);
+                throw(pqxx::sql_error("Could not enter pipeline mode: " + message));
+            }
+            EventLoop::getInstance().add(this);
+            info("Asynchronous database connection opened.");
+        }
+        AsyncConnection(const AsyncConnection &) = delete;
+        AsyncConnection &operator=(const AsyncConnection &) = delete;
+        ~AsyncConnection()
+        {
+            EventLoop::getInstance().remove(this);
+            PQfinish(connection);
+            info("Asynchronous database connection closed.");
+        }
+
+        int getDescriptor() const override { return PQsocket(connection); }
+        short getEvents() const override
+        {
+            if (inFlight.empty())
+                return 0;
+            return flushing ? POLLIN | POLLOUT : POLLIN;
+        }
+        void process(short events) override
+        {
+            // whatever could not be sent before goes out once the socket takes it
+            if (flushing && (events & POLLOUT) != 0)
+            {
+                auto flushed = PQflush(connection);
+                if (flushed == -1)
+                {
+                    reset("Could not send queries: " + string(PQerrorMessage(connection)));
+                    return;
+                }
+                flushing = flushed == 1;
+            }
+            if ((events & (POLLIN | POLLERR | POLLHUP)) != 0 && PQconsumeInput(connection) != 1)
+            {
+                reset("Could not read query results: " + string(PQerrorMessage(connection)));
+                return;
+            }
+            collect();
+        }
+
+        size_t getInFlight() const { return inFlight.size(); }
+        // false once the connection is lost, until a reset opens it again
+        bool isOpen() const { return PQstatus(connection) == CONNECTION_OK; }
+
+        // the statements run in order as a single transaction: if one fails, those before it are rolled back and
+        // those after it skipped; the result of each statement is returned
+        BatchAwaiter execute(vector<AsyncStatement> statements) { return BatchAwaiter(*this, move(statements)); }
+        BatchAwaiter execute(AsyncStatement statement) { return execute(vector<AsyncStatement>{move(statement)}); }
+    };
+};
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 
 #include <cryptopp/sha.h>
@@ -28,24 +29,26 @@ namespace bank
         string code;
 
     public:
-        Currency(string name, string code) : name(name), code(code) {}
+        Currency(string name, string code) : name(move(name)), code(move(code)) {}
         Currency() {}
+        // copies go into every account and transaction, so moves are kept alongside them
+        Currency(const Currency &other) = default;
+        Currency(Currency &&other) = default;
         ~Currency() {}
+        Currency &operator=(const Currency &other) = default;
+        Currency &operator=(Currency &&other) = default;
 
         string getName() const { return name; }
         void setName(string name) { name = name; }
 
-        string getCode() const { return code; }
+        const string &getCode() const { return code; }
         void setCode(string code) { code = code; }
 
         bool operator!=(const Currency &other) { return (other.code != code && other.name != name); }
 
         friend ostream &operator<<(ostream &out, const Currency &currency)
         {
-            string nameOutput = "Currency name: " + currency.name;
-            string codeOutput = "Currency code: " + currency.code;
-            out << nameOutput << endl
-                << codeOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "Currency name: {}\nCurrency code: {}\n", currency.name, currency.code);
             return out;
         }
     };
@@ -57,7 +60,7 @@ namespace bank
         double rate;
 
     public:
-        Exchange(Currency &source, Currency &destination, double rate) : source(source), destination(destination), rate(rate) {}
+        Exchange(const Currency &source, const Currency &destination, double rate) : source(source), destination(destination), rate(rate) {}
         Exchange() {}
         ~Exchange() {}
 
@@ -72,10 +75,7 @@ namespace bank
 
         friend ostream &operator<<(ostream &out, const Exchange &exchange)
         {
-            string exchangeOutput = "Exchange: " + exchange.source.getCode() + " -> " + exchange.destination.getCode();
-            string rateOutput = "Exchange rate: " + to_string(exchange.rate);
-            out << exchangeOutput << endl
-                << rateOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "Exchange: {} -> {}\nExchange rate: {:f}\n", exchange.source.getCode(), exchange.destination.getCode(), exchange.rate);
             return out;
         }
     };
@@ -152,12 +152,8 @@ namespace bank
             if (pattern.length() < 15 || pattern.length() > 34)
                 throw(ValidationException("IBAN pattern must have a length between 15 and 34 characters."));
         }
-        Country(const Country &other)
-        {
-            name = other.name;
-            code = other.code;
-            IBANPattern = other.IBANPattern;
-        }
+        Country(const Country &other) = default;
+        Country(Country &&other) = default;
         Country() {}
         ~Country() {}
 
@@ -172,22 +168,11 @@ namespace bank
 
         friend ostream &operator<<(ostream &out, const Country &country)
         {
-            string header = "Country information:";
-            string nameOutput = "Name: " + country.name;
-            string codeOutput = "Code: " + country.code;
-            string IBANPatternOutput = "IBANPattern: " + country.IBANPattern;
-            out << header << endl
-                << nameOutput << endl
-                << codeOutput << endl
-                << IBANPatternOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "Country information:\nName: {}\nCode: {}\nIBANPattern: {}\n", country.name, country.code, country.IBANPattern);
             return out;
         }
-        void operator=(const Country &other)
-        {
-            name = other.name;
-            code = other.code;
-            IBANPattern = other.IBANPattern;
-        }
+        Country &operator=(const Country &other) = default;
+        Country &operator=(Country &&other) = default;
 
         bool isIBANValid(string IBAN)
         {
@@ -262,8 +247,12 @@ namespace bank
         }
 
     public:
+        // the administrator is the user seeded with this email, its id depends on the database
+        inline static const string administratorEmail = "admin@admin.com";
+
         // used for instantiating an existing account
-        User(Country &country, string email, string firstName, string lastName, string password) : country(country), email(email), firstName(firstName), lastName(lastName), password(password) {}
+        User(const Country &country, string email, string firstName, string lastName, string password)
+            : country(country), email(move(email)), firstName(move(firstName)), lastName(move(lastName)), password(move(password)) {}
         // used for registering new account
         User(string emailProvided, string firstName, string lastName, string passwordNotHashed, Country &country) : country(country), email(emailProvided), firstName(firstName), lastName(lastName)
         {
@@ -278,15 +267,9 @@ namespace bank
             if (firstName.empty() || lastName.empty())
                 throw(ValidationException("First name and last name must be non-empty."));
         }
-        User(const User &other)
-        {
-            country = other.country;
-            email = other.email;
-            firstName = other.firstName;
-            lastName = other.lastName;
-            password = other.password;
-        }
         User() {}
+        User(const User &other) = default;
+        User(User &&other) = default;
         ~User() {}
 
         string getPassword() const { return password; }
@@ -304,22 +287,11 @@ namespace bank
 
         friend ostream &operator<<(ostream &out, const User &user)
         {
-            string emailOutput = "Email: " + user.email;
-            string nameOutput = "Full name: " + user.getFullName();
-            string countryOutput = "Country: " + user.country.getName();
-            out << emailOutput << endl
-                << nameOutput << endl
-                << countryOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "Email: {}\nFull name: {} {}\nCountry: {}\n", user.email, user.firstName, user.lastName, user.country.getName());
             return out;
         }
-        void operator=(const User &other)
-        {
-            country = other.country;
-            email = other.email;
-            firstName = other.firstName;
-            lastName = other.lastName;
-            password = other.password;
-        }
+        User &operator=(const User &other) = default;
+        User &operator=(User &&other) = default;
         bool operator==(const User &other) { return (other.email == email); }
         bool operator!=(const User &other) { return (other.email != email); }
 
@@ -342,7 +314,8 @@ namespace bank
 
     public:
         // used for instantiating an existing account
-        Account(Currency &currency, User &user, string IBAN, double amount, string firstName, string lastName) : currency(currency), user(user), IBAN(IBAN), amount(amount), firstName(firstName), lastName(lastName) {}
+        Account(const Currency &currency, const User &user, string IBAN, double amount, string firstName, string lastName)
+            : currency(currency), user(user), IBAN(move(IBAN)), amount(amount), firstName(move(firstName)), lastName(move(lastName)) {}
         // used for creating a new account
         Account(Currency &currency, User &user, string firstName, string lastName) : currency(currency), user(user), firstName(firstName), lastName(lastName)
         {
@@ -350,18 +323,22 @@ namespace bank
             amount = 0;
         }
         Account() { amount = 0; }
+        Account(const Account &other) = default;
+        Account(Account &&other) = default;
         ~Account() {}
+        Account &operator=(const Account &other) = default;
+        Account &operator=(Account &&other) = default;
 
         double getAmount() const { return amount; }
-        void setAmount(double amount) { amount = amount; }
+        void setAmount(double amount) { this->amount = amount; }
 
-        string getIBAN() const { return IBAN; }
+        const string &getIBAN() const { return IBAN; }
         void setIBAN(string IBAN) { IBAN = IBAN; }
 
         User getUser() const { return user; }
         void setUser(User user) { user = user; }
 
-        Currency getCurrency() const { return currency; }
+        const Currency &getCurrency() const { return currency; }
         void setCurrency(Currency currency) { currency = currency; }
 
         string getFullName() const { return firstName + " " + lastName; }
@@ -370,14 +347,7 @@ namespace bank
 
         friend ostream &operator<<(ostream &out, const Account &account)
         {
-            string IBANOutput = "IBAN: " + account.IBAN;
-            string amountOutput = "Amount: " + to_string(account.amount);
-            string currencyOutput = "Currency: " + account.currency.getCode();
-            string nameOutput = "Holder full name: " + account.getFullName();
-            cout << IBANOutput << endl
-                 << amountOutput << endl
-                 << currencyOutput << endl
-                 << nameOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "IBAN: {}\nAmount: {:f}\nCurrency: {}\nHolder full name: {} {}\n", account.IBAN, account.amount, account.currency.getCode(), account.firstName, account.lastName);
             return out;
         }
         bool operator==(const Account &other) const { return (IBAN == other.IBAN); }
@@ -390,32 +360,38 @@ namespace bank
         Account outbound;
         double amount;
         time_point<system_clock> date;
+        // from the outbound to the inbound account's currency, at the time of the transaction
+        double rate;
 
     public:
-        Transaction(Account &inbound, Account &outbound, double amount, time_point<system_clock> date) : inbound(inbound), outbound(outbound), amount(amount), date(date) {}
+        Transaction(const Account &inbound, const Account &outbound, double amount, time_point<system_clock> date, double rate = 1)
+            : inbound(inbound), outbound(outbound), amount(amount), date(date), rate(rate) {}
+        Transaction(const Transaction &other) = default;
+        Transaction(Transaction &&other) = default;
         ~Transaction() {}
+        Transaction &operator=(const Transaction &other) = default;
+        Transaction &operator=(Transaction &&other) = default;
 
         double getAmount() const { return amount; }
         void setAmount(double amount) { amount = amount; }
 
-        Account getInbound() const { return inbound; }
+        const Account &getInbound() const { return inbound; }
         void setInbound(Account newInbound) { inbound = newInbound; }
 
-        Account getOutbound() const { return outbound; }
+        const Account &getOutbound() const { return outbound; }
         void setOutbound(Account newOutbound) { outbound = newOutbound; }
 
+        double getRate() const { return rate; }
+        void setRate(double newRate) { rate = newRate; }
+        double getConvertedAmount() const { return amount * rate; }
+
         time_point<system_clock> getDate() const { return date; }
         string getDateString() const { return std::format("{:%F %T}", date); }
         void setDate(time_point<system_clock> date) { date = date; }
 
         friend ostream &operator<<(ostream &out, const Transaction &transaction)
         {
-            string transactionOutput = "Transaction: " + transaction.outbound.getIBAN() + " -> " + transaction.inbound.getIBAN();
-            string amountOutput = "Transaction amount: " + to_string(transaction.amount);
-            string dateOutput = "Transaction date: " + transaction.getDateString();
-            out << transactionOutput << endl
-                << amountOutput << endl
-                << dateOutput << endl;
+            format_to(ostreambuf_iterator<char>(out), "Transaction: {} -> {}\nTransaction amount: {:f}\nTransaction date: {:%F %T}\n", transaction.outbound.getIBAN(), transaction.inbound.getIBAN(), transaction.amount, transaction.date);
             return out;
         }
     };
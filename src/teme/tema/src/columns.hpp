@@ -0,0 +1,485 @@
+#include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace database
+{
+    // count and sum of the amounts of the transactions matching a filter
+    class AmountTotals
+    {
+    private:
+        long long count;
+        double sum;
+
+    public:
+        AmountTotals(long long count = 0, double sum = 0) : count(count), sum(sum) {}
+        ~AmountTotals() {}
+
+        long long getCount() const { return count; }
+        double getSum() const { return sum; }
+
+        AmountTotals &operator+=(const AmountTotals &other)
+        {
+            count += other.count;
+            sum += other.sum;
+            return *this;
+        }
+    };
+
+    // totals indexed by currency
+    class CurrencyTotals
+    {
+    private:
+        vector<AmountTotals> totals;
+
+    public:
+        CurrencyTotals(size_t currencies = 0) : totals(currencies) {}
+        ~CurrencyTotals() {}
+
+        size_t size() const { return totals.size(); }
+        AmountTotals &operator[](size_t currency) { return totals[currency]; }
+        const AmountTotals &operator[](size_t currency) const { return totals[currency]; }
+
+        CurrencyTotals &operator+=(const CurrencyTotals &other)
+        {
+            if (totals.size() < other.totals.size())
+                totals.resize(other.totals.size());
+            for (size_t currency = 0; currency < other.totals.size(); currency++)
+                totals[currency] += other.totals[currency];
+            return *this;
+        }
+    };
+
+    // threads started once and kept for the scans, so a scan does not pay for starting threads; the calling
+    // thread takes chunks of its own scan too, so a scan completes even while the workers are busy with others
+    class ScanPool
+    {
+    private:
+        // the chunks of one scan, shared with the workers that help with it
+        class Scan
+        {
+        public:
+            size_t count;
+            function<void(size_t)> task;
+            atomic<size_t> next = 0;
+            size_t completed = 0;
+            mutex completedMutex;
+            condition_variable allCompleted;
+
+            Scan(size_t count, function<void(size_t)> task) : count(count), task(move(task)) {}
+
+            void work()
+            {
+                size_t done = 0;
+                for (auto chunk = next.fetch_add(1); chunk < count; chunk = next.fetch_add(1))
+                {
+                    task(chunk);
+                    done++;
+                }
+                if (done == 0)
+                    return;
+                lock_guard<mutex> lock(completedMutex);
+                if ((completed += done) == count)
+                    allCompleted.notify_all();
+            }
+        };
+
+        mutex scansMutex;
+        condition_variable scansAvailable;
+        deque<shared_ptr<Scan>> scans;
+        vector<thread> workers;
+        bool stopping = false;
+
+        ScanPool()
+        {
+            for (unsigned worker = 1; worker < max(1u, thread::hardware_concurrency()); worker++)
+                workers.emplace_back([this]()
+                                     {
+                                         while (true)
+                                         {
+                                             shared_ptr<Scan> scan;
+                                             {
+                                                 unique_lock<mutex> lock(scansMutex);
+                                                 scansAvailable.wait(lock, [this]()
+                                                                     { return stopping || !scans.empty(); });
+                                                 if (scans.empty())
+                                                     return;
+                                                 scan = scans.front();
+                                                 scans.pop_front();
+                                             }
+                                             scan->work();
+                                         } });
+        }
+
+    public:
+        ScanPool(const ScanPool &) = delete;
+        ~ScanPool()
+        {
+            {
+                lock_guard<mutex> lock(scansMutex);
+                stopping = true;
+            }
+            scansAvailable.notify_all();
+            for (auto &worker : workers)
+                worker.join();
+        }
+
+        static ScanPool &getInstance()
+        {
+            static ScanPool instance;
+            return instance;
+        }
+
+        size_t getThreadCount() const { return workers.size() + 1; }
+
+        // runs task(0), ..., task(count - 1) and returns once all of them are done
+        void run(size_t count, function<void(size_t)> task)
+        {
+            auto scan = make_shared<Scan>(count, move(task));
+            size_t helpers = min(count, workers.size() + 1) - 1;
+            if (helpers > 0)
+            {
+                {
+                    lock_guard<mutex> lock(scansMutex);
+                    for (size_t helper = 0; helper < helpers; helper++)
+                        scans.emplace_back(scan);
+                }
+                scansAvailable.notify_all();
+            }
+            scan->work();
+            unique_lock<mutex> lock(scan->completedMutex);
+            scan->allCompleted.wait(lock, [&scan]()
+                                    { return scan->completed == scan->count; });
+        }
+    };
+
+    // converts a column of amounts, each in its own currency, into a single currency: the rate of every currency
+    // is gathered from a table indexed by currency id, and the converted amounts are rounded to cents, half to
+    // even, the same way by the vector and the scalar loops, so the result does not depend on how it was split
+    class AmountConverter
+    {
+    private:
+        // below this many amounts, a conversion is not worth spreading over threads
+        inline static const size_t minimumChunkRows = 1 << 16;
+
+        // by currency id, NaN for currencies without a rate
+        vector<double> rates;
+
+        // converts the amounts in [begin, end), returns false if one of them has a currency without a rate
+        bool convertRange(const double *amounts, const long long *currencies, double *converted, size_t begin, size_t end) const
+        {
+            const double *table = rates.data();
+            const long long size = static_cast<long long>(rates.size());
+            bool valid = true;
+            size_t row = begin;
+#if defined(__AVX2__)
+            const __m256d cents = _mm256_set1_pd(100);
+            const __m256d missing = _mm256_set1_pd(numeric_limits<double>::quiet_NaN());
+            const __m256i lower = _mm256_set1_epi64x(-1);
+            const __m256i upper = _mm256_set1_epi64x(size);
+            __m256d invalid = _mm256_setzero_pd();
+            for (; row + 4 <= end; row += 4)
+            {
+                __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&currencies[row]));
+                // ids outside of the table are not gathered and stay NaN
+                __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi64(index, lower), _mm256_cmpgt_epi64(upper, index));
+                __m256d rate = _mm256_mask_i64gather_pd(missing, table, index, _mm256_castsi256_pd(inside), 8);
+                __m256d value = _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(&amounts[row]), rate), cents);
+                value = _mm256_div_pd(_mm256_round_pd(value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), cents);
+                invalid = _mm256_or_pd(invalid, _mm256_cmp_pd(rate, rate, _CMP_UNORD_Q));
+                _mm256_storeu_pd(&converted[row], value);
+            }
+            valid = _mm256_movemask_pd(invalid) == 0;
+#endif
+            for (; row < end; row++)
+            {
+                auto currency = currencies[row];
+                double rate = currency >= 0 && currency < size ? table[currency] : numeric_limits<double>::quiet_NaN();
+                valid &= !isnan(rate);
+                converted[row] = nearbyint(amounts[row] * rate * 100) / 100;
+            }
+            return valid;
+        }
+
+    public:
+        AmountConverter(vector<double> rates) : rates(move(rates)) {}
+        ~AmountConverter() {}
+
+        // returns false if an amount has a currency without a rate, its converted amount is then NaN
+        bool convert(const vector<double> &amounts, const vector<long long> &currencies, vector<double> &converted) const
+        {
+            size_t size = min(amounts.size(), currencies.size());
+            converted.resize(size);
+            size_t chunks = min(ScanPool::getInstance().getThreadCount(), max<size_t>(1, size / minimumChunkRows));
+            if (chunks == 1)
+                return convertRange(amounts.data(), currencies.data(), converted.data(), 0, size);
+
+            vector<char> valid(chunks);
+            size_t chunkRows = (size + chunks - 1) / chunks;
+            ScanPool::getInstance().run(chunks, [&](size_t chunk)
+                                        { valid[chunk] = convertRange(amounts.data(), currencies.data(), converted.data(), min(size, chunk * chunkRows),
+                                                                      min(size, (chunk + 1) * chunkRows)); });
+            return all_of(valid.begin(), valid.end(), [](char chunkValid)
+                          { return chunkValid != 0; });
+        }
+    };
+
+    // transactions kept column by column, each in a contiguous array, so scans only touch the columns
+    // they filter and aggregate on; every account has a posting list with the rows it takes part in.
+    // Rows are only ever appended, deletes compact the columns
+    class TransactionColumns
+    {
+    private:
+        // below this many rows, a scan is not worth spreading over threads
+        inline static const size_t minimumChunkRows = 1 << 16;
+
+        vector<long long> ids;
+        vector<long long> inbound;
+        vector<long long> outbound;
+        vector<int32_t> inboundCurrencies;
+        vector<int32_t> outboundCurrencies;
+        vector<double> amounts;
+        vector<double> rates;
+        // seconds since the epoch
+        vector<int64_t> timestamps;
+        unordered_map<long long, vector<uint32_t>> postings;
+        // currencies are stored as indexes into this list
+        vector<string> currencyCodes;
+        unordered_map<string, int32_t> currencyIndexes;
+
+        int32_t getCurrencyIndex(const string &code)
+        {
+            auto entry = currencyIndexes.find(code);
+            if (entry != currencyIndexes.end())
+                return entry->second;
+            currencyCodes.emplace_back(code);
+            return currencyIndexes[code] = static_cast<int32_t>(currencyCodes.size() - 1);
+        }
+
+        // sums the amounts of the rows in [begin, end) with from <= timestamp < to, by outbound currency, all
+        // currencies in the same pass over the columns
+        CurrencyTotals sumRange(size_t begin, size_t end, int64_t from, int64_t to) const
+        {
+            size_t currencyCount = currencyCodes.size();
+            vector<long long> counts(currencyCount, 0);
+            vector<double> sums(currencyCount, 0);
+            size_t row = begin;
+#if defined(__AVX2__)
+            // the lanes of a currency
+            struct alignas(32) Lanes
+            {
+                __m256d sums = _mm256_setzero_pd();
+                __m256i counts = _mm256_setzero_si256();
+                __m256i currency;
+            };
+            vector<Lanes> lanes(currencyCount);
+            for (size_t currency = 0; currency < currencyCount; currency++)
+                lanes[currency].currency = _mm256_set1_epi64x(static_cast<long long>(currency));
+            const __m256i lower = _mm256_set1_epi64x(from - 1);
+            const __m256i upper = _mm256_set1_epi64x(to);
+            for (; row + 4 <= end; row += 4)
+            {
+                __m256i time = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&timestamps[row]));
+                __m256i rowCurrencies = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&outboundCurrencies[row])));
+                __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi64(time, lower), _mm256_cmpgt_epi64(upper, time));
+                __m256d amount = _mm256_loadu_pd(&amounts[row]);
+                for (auto &currency : lanes)
+                {
+                    __m256i mask = _mm256_and_si256(inside, _mm256_cmpeq_epi64(rowCurrencies, currency.currency));
+                    currency.sums = _mm256_add_pd(currency.sums, _mm256_and_pd(amount, _mm256_castsi256_pd(mask)));
+                    // matching lanes are -1
+                    currency.counts = _mm256_sub_epi64(currency.counts, mask);
+                }
+            }
+            for (size_t currency = 0; currency < currencyCount; currency++)
+            {
+                alignas(32) double laneSums[4];
+                alignas(32) long long laneCounts[4];
+                _mm256_store_pd(laneSums, lanes[currency].sums);
+                _mm256_store_si256(reinterpret_cast<__m256i *>(laneCounts), lanes[currency].counts);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    sums[currency] += laneSums[lane];
+                    counts[currency] += laneCounts[lane];
+                }
+            }
+#endif
+            for (; row < end; row++)
+                if (timestamps[row] >= from && timestamps[row] < to)
+                {
+                    sums[outboundCurrencies[row]] += amounts[row];
+                    counts[outboundCurrencies[row]]++;
+                }
+
+            CurrencyTotals totals(currencyCount);
+            for (size_t currency = 0; currency < currencyCount; currency++)
+                totals[currency] = AmountTotals(counts[currency], sums[currency]);
+            return totals;
+        }
+
+        // moves the rows to keep down in a single pass, and rebuilds the posting lists
+        template <typename Predicate>
+        void eraseRows(Predicate erased)
+        {
+            size_t kept = 0;
+            for (size_t row = 0; row < ids.size(); row++)
+            {
+                if (erased(row))
+                    continue;
+                ids[kept] = ids[row];
+                inbound[kept] = inbound[row];
+                outbound[kept] = outbound[row];
+                inboundCurrencies[kept] = inboundCurrencies[row];
+                outboundCurrencies[kept] = outboundCurrencies[row];
+                amounts[kept] = amounts[row];
+                rates[kept] = rates[row];
+                timestamps[kept] = timestamps[row];
+                kept++;
+            }
+            if (kept == ids.size())
+                return;
+            ids.resize(kept);
+            inbound.resize(kept);
+            outbound.resize(kept);
+            inboundCurrencies.resize(kept);
+            outboundCurrencies.resize(kept);
+            amounts.resize(kept);
+            rates.resize(kept);
+            timestamps.resize(kept);
+
+            postings.clear();
+            for (uint32_t row = 0; row < kept; row++)
+            {
+                postings[inbound[row]].emplace_back(row);
+                if (outbound[row] != inbound[row])
+                    postings[outbound[row]].emplace_back(row);
+            }
+        }
+
+        // splits [0, size) into one chunk per core of the scan pool and combines the partial results
+        template <typename Result, typename Kernel>
+        Result parallelScan(size_t size, Kernel kernel) const
+        {
+            size_t chunks = min(ScanPool::getInstance().getThreadCount(), max<size_t>(1, size / minimumChunkRows));
+            if (chunks == 1)
+                return kernel(0, size);
+
+            vector<Result> partials(chunks);
+            size_t chunkRows = (size + chunks - 1) / chunks;
+            ScanPool::getInstance().run(chunks, [&](size_t chunk)
+                                        { partials[chunk] = kernel(min(size, chunk * chunkRows), min(size, (chunk + 1) * chunkRows)); });
+
+            Result result;
+            for (const auto &partial : partials)
+                result += partial;
+            return result;
+        }
+
+    public:
+        TransactionColumns() {}
+        ~TransactionColumns() {}
+
+        size_t size() const { return ids.size(); }
+        void clear()
+        {
+            ids.clear();
+            inbound.clear();
+            outbound.clear();
+            inboundCurrencies.clear();
+            outboundCurrencies.clear();
+            amounts.clear();
+            rates.clear();
+            timestamps.clear();
+            postings.clear();
+            currencyCodes.clear();
+            currencyIndexes.clear();
+        }
+        void reserve(size_t rows)
+        {
+            ids.reserve(rows);
+            inbound.reserve(rows);
+            outbound.reserve(rows);
+            inboundCurrencies.reserve(rows);
+            outboundCurrencies.reserve(rows);
+            amounts.reserve(rows);
+            rates.reserve(rows);
+            timestamps.reserve(rows);
+        }
+        void append(long long id, long long inboundId, long long outboundId, const string &inboundCurrency, const string &outboundCurrency, double amount, double rate,
+                    time_point<system_clock> date)
+        {
+            auto row = static_cast<uint32_t>(ids.size());
+            ids.emplace_back(id);
+            inbound.emplace_back(inboundId);
+            outbound.emplace_back(outboundId);
+            inboundCurrencies.emplace_back(getCurrencyIndex(inboundCurrency));
+            outboundCurrencies.emplace_back(getCurrencyIndex(outboundCurrency));
+            amounts.emplace_back(amount);
+            rates.emplace_back(rate);
+            timestamps.emplace_back(duration_cast<seconds>(date.time_since_epoch()).count());
+            postings[inboundId].emplace_back(row);
+            if (outboundId != inboundId)
+                postings[outboundId].emplace_back(row);
+        }
+
+        // drops the rows of the given accounts
+        void eraseAccounts(const set<long long> &accountIds)
+        {
+            if (!accountIds.empty())
+                eraseRows([&](size_t row)
+                          { return accountIds.contains(inbound[row]) || accountIds.contains(outbound[row]); });
+        }
+        // drops the rows made before the given second
+        void eraseBefore(int64_t second)
+        {
+            eraseRows([&](size_t row)
+                      { return timestamps[row] < second; });
+        }
+
+        // totals of the transactions made in [from, to), by the code of the outbound currency
+        map<string, AmountTotals> getTotalsByCurrency(time_point<system_clock> from, time_point<system_clock> to) const
+        {
+            int64_t fromSeconds = duration_cast<seconds>(from.time_since_epoch()).count();
+            int64_t toSeconds = duration_cast<seconds>(to.time_since_epoch()).count();
+            auto totals = parallelScan<CurrencyTotals>(size(), [&](size_t begin, size_t end)
+                                                       { return sumRange(begin, end, fromSeconds, toSeconds); });
+            map<string, AmountTotals> result;
+            for (size_t currency = 0; currency < totals.size(); currency++)
+                if (totals[currency].getCount() > 0)
+                    result.emplace(currencyCodes[currency], totals[currency]);
+            return result;
+        }
+
+        // calls the visitor with (is inbound, amount, rate, seconds since the epoch) for every transaction of
+        // the account, in the order they were appended
+        template <typename Visitor>
+        void forEachAccountRow(long long accountId, Visitor visitor) const
+        {
+            auto posting = postings.find(accountId);
+            if (posting == postings.end())
+                return;
+            for (auto row : posting->second)
+                visitor(inbound[row] == accountId, amounts[row], rates[row], timestamps[row]);
+        }
+    };
+};
\ No newline at end of file
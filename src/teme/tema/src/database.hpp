@@ -1,9 +1,14 @@
 #include <map>
+#include <set>
 #include <any>
 #include <ctime>
 #include <chrono>
 #include <vector>
 #include <format>
+#include <sstream>
+#include <charconv>
+#include <limits>
+#include <unordered_map>
 #include <iostream>
 #include <typeinfo>
 #include <algorithm>
@@ -13,6 +18,7 @@ using namespace std;
 using namespace bank;
 using namespace spdlog;
 using namespace exception;
+using namespace tracing;
 
 namespace database
 {
@@ -20,9 +26,19 @@ namespace database
     class Entity
     {
     protected:
-        weak_ptr<pqxx::connection> connection;
+        shared_ptr<Storage> storage;
         map<KeyType, Data> data;
         string table;
+        // the columns parseData reads, in the order it reads them
+        mutable RecordBinding binding;
+
+        // resolved once, the cached lookups are too cheap to look metrics up by name
+        Counter *cacheHits;
+        Counter *cacheMisses;
+        Counter *cacheBypasses;
+        LatencyHistogram *queryHistogram;
+
+        LatencyHistogram &getOperationHistogram(const string &operation) const { return MetricsRegistry::getInstance().getHistogram("entity." + table + "." + operation); }
 
         inline static const string keyToString(KeyType key)
         {
@@ -30,57 +46,81 @@ namespace database
                 return to_string(key);
             throw(KeyTypeUnsupportedException(typeid(KeyType).name()));
         }
-        inline static const time_point<system_clock> stringToTimePoint(const string date, const string format = "%F %H:%M:%S") noexcept
+        inline static const time_point<system_clock> stringToTimePoint(string_view date) { return TimestampCodec::parse(date); }
+
+        virtual pair<KeyType, Data> parseData(const Record &record) const = 0;
+        // rows referring to entries deleted since the query was sent (i.e. read from a replica that has not caught up
+        // yet) are skipped, instead of failing the whole read
+        virtual bool isStale(const Record &) const { return false; }
+        RecordCallback getParser(map<KeyType, Data> &dataResult) const
         {
-            tm timeStruct = {};
-            istringstream ss(date);
-            ss >> get_time(&timeStruct, format.c_str());
-            return system_clock::from_time_t(mktime(&timeStruct));
+            // results mostly come in key order, the hint makes those inserts constant time
+            return [this, &dataResult](const Record &record)
+            {
+                if (!isStale(record))
+                    dataResult.emplace_hint(dataResult.end(), parseData(record));
+            };
         }
 
-        virtual pair<KeyType, Data> parseData(pqxx::row row) const = 0;
-        map<KeyType, Data> getRecords(Query &query) const
+        Entity(shared_ptr<Storage> storage, const string table, vector<string> columns) : storage(storage), table(table), binding(columns)
         {
-            auto result = query.execute();
-            map<KeyType, Data> dataResult;
-            for (auto const &row : result)
-                dataResult.insert(parseData(row));
-            return dataResult;
+            auto &registry = MetricsRegistry::getInstance();
+            cacheHits = &registry.getCounter("cache." + table + ".hits");
+            cacheMisses = &registry.getCounter("cache." + table + ".misses");
+            cacheBypasses = &registry.getCounter("cache." + table + ".bypasses");
+            queryHistogram = &getOperationHistogram("query");
         }
-
-        Entity(weak_ptr<pqxx::connection> &connection, const string table) : connection(connection), table(table) {}
         ~Entity() = default;
 
         map<KeyType, Data> getAllRecords() const
         {
-            Query query(connection, "SELECT * FROM :table;");
-            query.setParameter<string>("table", table, false);
-            return getRecords(query);
+            ScopedTimer queryTimer(*queryHistogram);
+            TraceSpan span("entity", table, "query");
+            map<KeyType, Data> dataResult;
+            storage->scan(table, getParser(dataResult));
+            return dataResult;
+        }
+        map<KeyType, Data> getRecordsByProperty(string property, string value) const { return getRecordsByProperty(map<string, string>{{property, value}}); }
+        map<KeyType, Data> getRecordsByProperty(map<string, string> properties) const
+        {
+            ScopedTimer queryTimer(*queryHistogram);
+            TraceSpan span("entity", table, "query");
+            map<KeyType, Data> dataResult;
+            storage->findByIndex(table, properties, getParser(dataResult));
+            return dataResult;
         }
-        map<KeyType, Data> getRecordsByProperty(string property, string value) const
+        map<KeyType, Data> getRecordsInRange(map<string, string> properties, string column, string from, string to) const
         {
-            Query query(connection, "SELECT * FROM :table WHERE :property=:value;");
-            query.setParameter<string>("table", table, false)
-                .template setParameter<string>("property", property, false)
-                .template setParameter<string>("value", value);
-            return getRecords(query);
+            ScopedTimer queryTimer(*queryHistogram);
+            TraceSpan span("entity", table, "query");
+            map<KeyType, Data> dataResult;
+            storage->findByRange(table, properties, column, from, to, getParser(dataResult));
+            return dataResult;
         }
-        map<KeyType, Data> getRecordsByProperty(map<string, string> properties) const
+        // coroutine versions, whose queries stay in flight while the caller starts others
+        Task<map<KeyType, Data>> getRecordsByPropertyAsync(map<string, string> properties) const
         {
-            Query query(connection, "SELECT * FROM :table WHERE ");
-            query.setParameter<string>("table", table, false);
-            long long index = 0;
-            for (const auto &property : properties)
-            {
-                query.append(":property=:value ")
-                    .setParameter<string>("property", property.first, false)
-                    .setParameter<string>("value", property.second);
-                index++;
-                if (index < properties.size())
-                    query.append(" AND ");
-            }
-            query.append(";");
-            return getRecords(query);
+            ScopedTimer queryTimer(*queryHistogram);
+            map<KeyType, Data> dataResult;
+            co_await storage->findByIndexAsync(table, properties, getParser(dataResult));
+            co_return dataResult;
+        }
+        Task<map<KeyType, Data>> getRecordsInRangeAsync(map<string, string> properties, string column, string from, string to) const
+        {
+            ScopedTimer queryTimer(*queryHistogram);
+            map<KeyType, Data> dataResult;
+            co_await storage->findByRangeAsync(table, properties, column, from, to, getParser(dataResult));
+            co_return dataResult;
+        }
+        Task<pair<KeyType, Data>> getRecordByPropertyAsync(string property, string value) const
+        {
+            map<string, string> properties = {{property, value}};
+            auto result = co_await getRecordsByPropertyAsync(properties);
+            if (result.size() > 1)
+                throw(EntryDuplicateFoundException("Multiple entries for unique property " + property + " found in table " + table + "!"));
+            if (result.empty())
+                throw(EntryNotFoundException("Could not find entry with property " + property + " in table " + table + "!"));
+            co_return *result.begin();
         }
         pair<KeyType, Data> getRecordByProperty(string property, string value) const
         {
@@ -105,49 +145,87 @@ namespace database
         }
         void deleteRecordsByProperty(string property, string value)
         {
-            Query query(connection, "DELETE FROM :table WHERE :property=:value;");
-            query.setParameter<string>("table", table, false)
-                .template setParameter<string>("property", property, false)
-                .template setParameter<string>("value", value);
-            query.execute();
+            ScopedTimer timer(getOperationHistogram("delete"));
+            TraceSpan span("entity", table, "delete");
+            storage->erase(table, property, value);
             loadData();
         }
 
     public:
-        void loadData() { data = getAllRecords(); }
+        virtual void loadData()
+        {
+            ScopedTimer timer(getOperationHistogram("load"));
+            TraceSpan span("entity", table, "load");
+            data = getAllRecords();
+        }
         map<KeyType, Data> getData() const { return data; }
-        virtual pair<KeyType, Data> getRecordById(KeyType id, bool cached = false) const
+        map<KeyType, Data> parseRecords(const pqxx::result &result) const
         {
-            if (cached)
+            // counted like the rows parsed by the storage, so both paths show up in the same statistics
+            static LatencyHistogram &parseHistogram = MetricsRegistry::getInstance().getHistogram("query.parse");
+            ThreadCounters::decodedRows += result.size();
+            ScopedTimer timer(parseHistogram);
+            TraceSpan span("entity", table, "parse");
+            map<KeyType, Data> dataResult;
+            Record record;
+            record.setColumns(result);
+            for (auto const &row : result)
             {
-                auto entry = data.find(id);
-                if (entry == data.end())
-                    throw(EntrySynchronizationException("Entry with ID " + keyToString(id) + " in table " + table + " is not synchronized!"));
-                return *entry;
+                record.assign(row);
+                dataResult.insert(parseData(record));
             }
+            return dataResult;
+        }
+        // the cached entry itself, for building other entries from it without copying it first
+        const Data &getCachedData(KeyType id) const
+        {
+            auto entry = data.find(id);
+            if (entry == data.end())
+            {
+                cacheMisses->add();
+                throw(EntrySynchronizationException("Entry with ID " + keyToString(id) + " in table " + table + " is not synchronized!"));
+            }
+            cacheHits->add();
+            return entry->second;
+        }
+        virtual pair<KeyType, Data> getRecordById(KeyType id, bool cached = false) const
+        {
+            if (cached)
+                return pair<KeyType, Data>(id, getCachedData(id));
             else
             {
-                auto entry = getRecordByProperty("id", keyToString(id));
-                return entry;
+                cacheBypasses->add();
+                ScopedTimer queryTimer(*queryHistogram);
+                TraceSpan span("entity", table, "query");
+                map<KeyType, Data> dataResult;
+                storage->findByKey(table, id, getParser(dataResult));
+                if (dataResult.empty())
+                    throw(EntryNotFoundException("Could not find entry with ID " + keyToString(id) + " in table " + table + "!"));
+                return *dataResult.begin();
             }
         }
         virtual void deleteRecordById(KeyType id) { deleteRecordsByProperty("id", keyToString(id)); }
+        bool isCached(KeyType id) const { return data.contains(id); }
+        // drops rows deleted behind the entity's back from the cache, without reloading the table
+        virtual void evictRecordsById(const vector<KeyType> &ids)
+        {
+            for (const auto &id : ids)
+                data.erase(id);
+        }
     };
 
     class CurrencyEntity : public Entity<long long, Currency>
     {
     private:
-        pair<long long, Currency> parseData(pqxx::row row) const override
+        pair<long long, Currency> parseData(const Record &record) const override
         {
-            auto id = row[0].as<long long>();
-            auto name = row[1].as<string>();
-            auto code = row[2].as<string>();
-            Currency currency(name, code);
-            return pair<long long, Currency>(id, currency);
+            const auto &column = binding.bind(record);
+            return pair<long long, Currency>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                             forward_as_tuple(record.get<string>(column[1]), record.get<string>(column[2])));
         }
 
     public:
-        CurrencyEntity(weak_ptr<pqxx::connection> connection) : Entity::Entity(connection, "currencies") {}
+        CurrencyEntity(shared_ptr<Storage> storage) : Entity::Entity(storage, "currencies", {"id", "name", "code"}) {}
         ~CurrencyEntity() = default;
 
         pair<long long, Currency> getRecordById(long long id, bool cached = true) const override { return Entity::getRecordById(id, cached); }
@@ -157,6 +235,14 @@ namespace database
             auto dataResult = data.find(result.first);
             return *dataResult;
         }
+        // from the cached currencies, there are only a handful of them
+        long long getCurrencyIdFromCode(const string &code) const
+        {
+            for (const auto &currency : data)
+                if (currency.second.getCode() == code)
+                    return currency.first;
+            throw(EntryNotFoundException("Could not find currency " + code + "!"));
+        }
         vector<pair<string, string>> getCurrencyDisplayData() const
         {
             vector<pair<string, string>> result;
@@ -170,27 +256,156 @@ namespace database
     {
     private:
         const CurrencyEntity &currencyEntity;
+        // every rate a currency pair has had, by (source, destination) ids, sorted by the time it became valid;
+        // the exchanges table holds the rates valid now
+        map<pair<long long, long long>, vector<pair<time_point<system_clock>, double>>> rateHistory;
 
-        pair<long long, Exchange> parseData(pqxx::row row) const override
+        void loadRateHistory()
+        {
+            ScopedTimer timer(getOperationHistogram("loadRates"));
+            TraceSpan span("entity", table, "loadRates");
+            map<pair<long long, long long>, vector<pair<time_point<system_clock>, double>>> history;
+            storage->scan("exchangerates", [&history](const Record &record)
+                          { history[make_pair(record.get<long long>(1), record.get<long long>(2))].emplace_back(record.get<time_point<system_clock>>(4),
+                                                                                                               record.get<double>(3)); });
+            for (auto &series : history)
+                sort(series.second.begin(), series.second.end());
+            rateHistory = move(history);
+        }
+        bool hasRate(long long sourceId, long long destinationId, time_point<system_clock> validFrom) const
         {
-            auto id = row[0].as<long long>();
-            auto sourceId = row[1].as<long long>();
-            auto destinationId = row[2].as<long long>();
-            auto rate = row[3].as<double>();
+            auto series = rateHistory.find(make_pair(sourceId, destinationId));
+            return series != rateHistory.end() && binary_search(series->second.begin(), series->second.end(), make_pair(validFrom, 0.0),
+                                                                [](const auto &first, const auto &second)
+                                                                { return first.first < second.first; });
+        }
 
-            auto source = currencyEntity.getRecordById(sourceId, true);
-            auto destination = currencyEntity.getRecordById(destinationId, true);
-            Exchange exchange(source.second, destination.second, rate);
-            return pair<long long, Exchange>(id, exchange);
+        pair<long long, Exchange> parseData(const Record &record) const override
+        {
+            const auto &column = binding.bind(record);
+            const auto &source = currencyEntity.getCachedData(record.get<long long>(column[1]));
+            const auto &destination = currencyEntity.getCachedData(record.get<long long>(column[2]));
+            return pair<long long, Exchange>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                             forward_as_tuple(source, destination, record.get<double>(column[3])));
         }
 
     public:
-        ExchangeEntity(weak_ptr<pqxx::connection> connection, CurrencyEntity &currencyEntity)
-            : Entity::Entity(connection, "exchanges"),
+        ExchangeEntity(shared_ptr<Storage> storage, CurrencyEntity &currencyEntity)
+            : Entity::Entity(storage, "exchanges", {"id", "source", "destination", "rate"}),
               currencyEntity(currencyEntity) {}
         ~ExchangeEntity() = default;
 
         pair<long long, Exchange> getRecordById(long long id, bool cached = true) const override { return Entity::getRecordById(id, cached); }
+        void loadData() override
+        {
+            Entity::loadData();
+            loadRateHistory();
+        }
+
+        // the rate valid at the given time, found by binary search in the pair's history
+        double getRate(long long sourceId, long long destinationId, time_point<system_clock> at) const
+        {
+            auto series = rateHistory.find(make_pair(sourceId, destinationId));
+            if (series != rateHistory.end())
+            {
+                auto next = upper_bound(series->second.begin(), series->second.end(), at, [](time_point<system_clock> value, const auto &point)
+                                        { return value < point.first; });
+                if (next != series->second.begin())
+                    return prev(next)->second;
+            }
+            throw(EntryNotFoundException(std::format("There is no exchange rate from {} to {} at {:%F %T}!", currencyEntity.getRecordById(sourceId).second.getCode(),
+                                                     currencyEntity.getRecordById(destinationId).second.getCode(), floor<seconds>(at))));
+        }
+        double getRate(const string &sourceCode, const string &destinationCode, time_point<system_clock> at) const
+        {
+            return getRate(currencyEntity.getCurrencyIdFromCode(sourceCode), currencyEntity.getCurrencyIdFromCode(destinationCode), at);
+        }
+
+        // converts a column of amounts, with the currency ids in another column, into the target currency at the rates
+        // valid at the given time, rounded to cents; the rate table is built once, so converting millions of amounts
+        // is a gather and a multiply per amount
+        vector<double> convertAmounts(const vector<double> &amounts, const vector<long long> &currencyIds, const string &targetCode,
+                                      time_point<system_clock> at = system_clock::now()) const
+        {
+            if (amounts.size() != currencyIds.size())
+                throw(ValidationException("Every amount needs a currency!"));
+            ScopedTimer timer(getOperationHistogram("convertAmounts"));
+            TraceSpan span("entity", table, "convertAmounts");
+            auto targetId = currencyEntity.getCurrencyIdFromCode(targetCode);
+            long long maximumId = targetId;
+            for (const auto &currency : currencyEntity.getData())
+                maximumId = max(maximumId, currency.first);
+
+            vector<double> rates(maximumId + 1, numeric_limits<double>::quiet_NaN());
+            rates[targetId] = 1;
+            for (const auto &series : rateHistory)
+                if (series.first.second == targetId && series.first.first >= 0 && series.first.first <= maximumId && series.first.first != targetId)
+                {
+                    auto next = upper_bound(series.second.begin(), series.second.end(), at, [](time_point<system_clock> value, const auto &point)
+                                            { return value < point.first; });
+                    if (next != series.second.begin())
+                        rates[series.first.first] = prev(next)->second;
+                }
+
+            vector<double> converted;
+            if (!AmountConverter(move(rates)).convert(amounts, currencyIds, converted))
+                throw(EntryNotFoundException(std::format("Some of the amounts have no exchange rate to {} at {:%F %T}!", targetCode, floor<seconds>(at))));
+            return converted;
+        }
+
+        // reads "source code,destination code,rate,valid from" lines (YYYY-MM-DD [HH:MM:SS]), i.e. a day's rate feed,
+        // and inserts them in a single statement; rates already known are skipped, and the current rates of the
+        // pairs are updated afterwards. Returns the number of new rates
+        long long ingestRates(istream &feed)
+        {
+            ScopedTimer timer(getOperationHistogram("ingestRates"));
+            TraceSpan span("entity", table, "ingestRates");
+            vector<vector<string>> rows;
+            set<tuple<long long, long long, string>> feedRates;
+            long long lineNumber = 0;
+            for (string line; getline(feed, line);)
+            {
+                lineNumber++;
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (line.empty() || line.starts_with("source"))
+                    continue;
+
+                vector<string> fields;
+                istringstream lineStream(line);
+                for (string field; getline(lineStream, field, ',');)
+                    fields.emplace_back(field);
+                if (fields.size() != 4 || !Validator::isTimestamp(fields[3]))
+                    throw(ValidationException(std::format("Malformed rate on line {}, expected source,destination,rate,YYYY-MM-DD [HH:MM:SS]!", lineNumber)));
+                double rate = 0;
+                if (from_chars(fields[2].data(), fields[2].data() + fields[2].size(), rate).ec != errc() || rate <= 0)
+                    throw(ValidationException(std::format("Invalid rate {} on line {}!", fields[2], lineNumber)));
+
+                auto sourceId = currencyEntity.getCurrencyIdFromCode(fields[0]);
+                auto destinationId = currencyEntity.getCurrencyIdFromCode(fields[1]);
+                auto validFrom = fields[3].size() == 10 ? fields[3] + " 00:00:00" : fields[3];
+                if (hasRate(sourceId, destinationId, stringToTimePoint(validFrom)) || !feedRates.emplace(sourceId, destinationId, validFrom).second)
+                    continue;
+                rows.push_back({to_string(sourceId), to_string(destinationId), fields[2], validFrom});
+            }
+
+            auto inserted = storage->insertMany("exchangerates", {"source", "destination", "rate", "validFrom"}, rows);
+            loadRateHistory();
+
+            auto now = system_clock::now();
+            for (const auto &exchange : data)
+            {
+                auto sourceId = currencyEntity.getCurrencyIdFromCode(exchange.second.getSource().getCode());
+                auto destinationId = currencyEntity.getCurrencyIdFromCode(exchange.second.getDestination().getCode());
+                auto currentRate = getRate(sourceId, destinationId, now);
+                if (currentRate != exchange.second.getRate())
+                    storage->update(table, exchange.first, {{"rate", std::format("{}", currentRate)}});
+            }
+            Entity::loadData();
+            info("event=rates.ingested lines={} inserted={}", lineNumber, inserted);
+            return inserted;
+        }
+
         pair<long long, Exchange> getExchangeFromCurrencyCodes(string sourceCode, string destinationCode) const
         {
             auto source = currencyEntity.getCurrencyFromCode(sourceCode);
@@ -211,18 +426,15 @@ namespace database
     class CountryEntity : public Entity<long long, Country>
     {
     private:
-        pair<long long, Country> parseData(pqxx::row row) const override
+        pair<long long, Country> parseData(const Record &record) const override
         {
-            auto id = row[0].as<long long>();
-            auto name = row[1].as<string>();
-            auto code = row[2].as<string>();
-            auto pattern = row[3].as<string>();
-            Country country(name, code, pattern);
-            return pair<long long, Country>(id, country);
+            const auto &column = binding.bind(record);
+            return pair<long long, Country>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                            forward_as_tuple(record.get<string>(column[1]), record.get<string>(column[2]), record.get<string>(column[3])));
         }
 
     public:
-        CountryEntity(weak_ptr<pqxx::connection> connection) : Entity::Entity(connection, "countries") {}
+        CountryEntity(shared_ptr<Storage> storage) : Entity::Entity(storage, "countries", {"id", "name", "code", "ibanPattern"}) {}
         ~CountryEntity() = default;
 
         vector<pair<string, string>> getCountryDisplayData() const
@@ -240,42 +452,36 @@ namespace database
     private:
         const CountryEntity &countryEntity;
 
-        pair<long long, User> parseData(pqxx::row row) const override
+        pair<long long, User> parseData(const Record &record) const override
         {
-            auto id = row[0].as<long long>();
-            auto countryId = row[1].as<long long>();
-            auto email = row[2].as<string>();
-            auto firstName = row[3].as<string>();
-            auto lastName = row[4].as<string>();
-            auto password = row[5].as<string>();
-
-            auto country = countryEntity.getRecordById(countryId, true);
-            User user(country.second, email, firstName, lastName, password);
-            return (pair<long long, User>(id, user));
+            const auto &column = binding.bind(record);
+            const auto &country = countryEntity.getCachedData(record.get<long long>(column[1]));
+            return pair<long long, User>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                         forward_as_tuple(country, record.get<string>(column[2]), record.get<string>(column[3]), record.get<string>(column[4]),
+                                                          record.get<string>(column[5])));
         }
 
     public:
-        UserEntity(weak_ptr<pqxx::connection> connection, CountryEntity &countryEntity)
-            : Entity::Entity(connection, "users"),
+        UserEntity(shared_ptr<Storage> storage, CountryEntity &countryEntity)
+            : Entity::Entity(storage, "users", {"id", "country", "email", "firstName", "lastName", "password"}),
               countryEntity(countryEntity) {}
         ~UserEntity() = default;
 
         pair<long long, User> getUserFromEmail(string email) const { return getRecordByProperty("email", email); }
         pair<long long, User> createUser(string countryCode, string email, string firstName, string lastName, string password)
         {
+            ScopedTimer timer(getOperationHistogram("create"));
+            TraceSpan span("entity", table, "create");
             auto country = countryEntity.getCountryFromCode(countryCode);
             User user(email, firstName, lastName, password, country.second);
 
-            Query query(connection, "INSERT INTO :table VALUES (DEFAULT, :country, :email, :firstName, :lastName, :password);");
-            query.setParameter<string>("table", table, false)
-                .setParameter<long long>("country", country.first)
-                .setParameter<string>("email", email)
-                .setParameter<string>("firstName", firstName)
-                .setParameter<string>("lastName", lastName)
-                .setParameter<string>("password", user.getPassword());
-            query.execute();
+            auto id = storage->insert(table, {{"country", to_string(country.first)},
+                                              {"email", email},
+                                              {"firstName", firstName},
+                                              {"lastName", lastName},
+                                              {"password", user.getPassword()}});
 
-            auto entry = getUserFromEmail(email);
+            auto entry = getRecordById(id);
             data.insert(entry);
             return entry;
         }
@@ -290,61 +496,117 @@ namespace database
         TransactionEntity &transactionEntity;
         const CurrencyEntity &currencyEntity;
         const UserEntity &userEntity;
+        shared_ptr<BalanceRanking> ranking = make_shared<BalanceRanking>();
 
-        pair<long long, Account> parseData(pqxx::row row) const override
-        {
-            auto id = row[0].as<long long>();
-            auto currencyId = row[1].as<long long>();
-            auto userId = row[2].as<long long>();
-            auto IBAN = row[3].as<string>();
-            auto amount = row[4].as<double>();
-            auto firstName = row[5].as<string>();
-            auto lastName = row[6].as<string>();
+        void rankAccount(const pair<long long, Account> &account) { ranking->set(account.first, account.second.getCurrency().getCode(), account.second.getAmount()); }
 
-            auto currency = currencyEntity.getRecordById(currencyId, true);
-            auto user = userEntity.getRecordById(userId, true);
-            Account account(currency.second, user.second, IBAN, amount, firstName, lastName);
-            return pair<long long, Account>(id, account);
+        pair<long long, Account> parseData(const Record &record) const override
+        {
+            const auto &column = binding.bind(record);
+            const auto &currency = currencyEntity.getCachedData(record.get<long long>(column[1]));
+            const auto &user = userEntity.getCachedData(record.get<long long>(column[2]));
+            return pair<long long, Account>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                            forward_as_tuple(currency, user, record.get<string>(column[3]), record.get<double>(column[4]), record.get<string>(column[5]),
+                                                             record.get<string>(column[6])));
         }
 
     public:
-        AccountEntity(weak_ptr<pqxx::connection> connection, CurrencyEntity &currencyEntity, UserEntity &userEntity, TransactionEntity &transactionEntity)
-            : Entity::Entity(connection, "accounts"),
+        AccountEntity(shared_ptr<Storage> storage, CurrencyEntity &currencyEntity, UserEntity &userEntity, TransactionEntity &transactionEntity)
+            : Entity::Entity(storage, "accounts", {"id", "currency", "associatedUser", "iban", "amount", "firstName", "lastName"}),
               currencyEntity(currencyEntity), userEntity(userEntity), transactionEntity(transactionEntity) {}
         ~AccountEntity() = default;
 
+        void loadData() override
+        {
+            Entity::loadData();
+            ranking->clear();
+            for (const auto &account : data)
+                rankAccount(account);
+        }
+        void evictRecordsById(const vector<long long> &accountIds) override
+        {
+            Entity::evictRecordsById(accountIds);
+            for (auto accountId : accountIds)
+                ranking->erase(accountId);
+        }
+
         pair<long long, Account> getAccountFromIBAN(string IBAN) const { return getRecordByProperty("iban", IBAN); }
+        Task<pair<long long, Account>> getAccountFromIBANAsync(string IBAN) const { return getRecordByPropertyAsync("iban", IBAN); }
+        // the count accounts with the largest balances in the currency, largest first
+        vector<pair<long long, Account>> getTopAccounts(const string &currencyCode, size_t count) const
+        {
+            ScopedTimer timer(getOperationHistogram("top"));
+            vector<pair<long long, Account>> result;
+            for (const auto &entry : ranking->getTop(currencyCode, count))
+            {
+                auto account = data.find(entry.first);
+                if (account != data.end())
+                    result.emplace_back(*account);
+            }
+            return result;
+        }
+        // the account's 1 based rank by balance among the accounts of its currency, and the number of those accounts
+        pair<size_t, size_t> getAccountRank(long long accountId) const
+        {
+            auto rank = ranking->getRank(accountId);
+            if (rank.first == 0)
+                throw(EntryNotFoundException("Could not find account " + to_string(accountId) + " in the balance ranking!"));
+            return rank;
+        }
         map<long long, Account> getUserAccounts(long long userId) const { return getRecordsByProperty("associatedUser", Entity::keyToString(userId)); }
+        Task<map<long long, Account>> getUserAccountsAsync(long long userId) const { return getRecordsByPropertyAsync(map<string, string>{{"associatedUser", Entity::keyToString(userId)}}); }
+        // balances and currency ids of every account, column by column, for batch conversions
+        pair<vector<double>, vector<long long>> getBalanceColumns() const
+        {
+            ScopedTimer queryTimer(*queryHistogram);
+            TraceSpan span("entity", table, "balances");
+            pair<vector<double>, vector<long long>> columns;
+            storage->scan(table, [this, &columns](const Record &record)
+                          {
+                              const auto &column = binding.bind(record);
+                              columns.first.emplace_back(record.get<double>(column[4]));
+                              columns.second.emplace_back(record.get<long long>(column[1])); });
+            return columns;
+        }
         pair<long long, Account> createAccount(string currencyCode, long long userId, string firstName, string lastName)
         {
+            ScopedTimer timer(getOperationHistogram("create"));
+            TraceSpan span("entity", table, "create");
             auto currency = currencyEntity.getCurrencyFromCode(currencyCode);
             auto user = userEntity.getRecordById(userId);
             Account account(currency.second, user.second, firstName, lastName);
 
-            Query query(connection, "INSERT INTO :table VALUES (DEFAULT, :currency, :user, :iban, :amount, :firstName, :lastName);");
-            query.setParameter<string>("table", table, false)
-                .setParameter<long long>("currency", currency.first)
-                .setParameter<long long>("user", user.first)
-                .setParameter<string>("iban", account.getIBAN())
-                .setParameter<double>("amount", account.getAmount())
-                .setParameter<string>("firstName", firstName)
-                .setParameter<string>("lastName", lastName);
-            query.execute();
-
-            auto entry = getAccountFromIBAN(account.getIBAN());
+            auto id = storage->insert(table, {{"currency", to_string(currency.first)},
+                                              {"associatedUser", to_string(user.first)},
+                                              {"iban", account.getIBAN()},
+                                              {"amount", std::format("{}", account.getAmount())},
+                                              {"firstName", firstName},
+                                              {"lastName", lastName},
+                                              {"opening", std::format("{}", account.getAmount())}});
+
+            auto entry = getRecordById(id);
             data.insert(entry);
+            rankAccount(entry);
             return entry;
         }
         void updateAccountAmount(long long accountId, double newAmount)
         {
-            Query query(connection, "UPDATE :table SET amount=:amount WHERE id=:id;");
-            query.setParameter<string>("table", table, false)
-                .setParameter<double>("amount", newAmount)
-                .setParameter<long long>("id", accountId);
-            query.execute();
+            ScopedTimer timer(getOperationHistogram("updateAmount"));
+            TraceSpan span("entity", table, "updateAmount");
+            storage->update(table, accountId, {{"amount", std::format("{}", newAmount)}});
             auto newAccount = getRecordById(accountId);
             data.erase(accountId);
             data.insert(newAccount);
+            rankAccount(newAccount);
+        }
+        // for balances written by someone else, i.e. with a transaction in a single batch
+        void cacheAccountAmount(long long accountId, double newAmount)
+        {
+            auto account = getRecordById(accountId, true);
+            account.second.setAmount(newAmount);
+            data.erase(accountId);
+            data.insert(account);
+            rankAccount(account);
         }
     };
 
@@ -354,82 +616,452 @@ namespace database
         AccountEntity &accountEntity;
         const ExchangeEntity &exchangeEntity;
 
-        pair<long long, Transaction> parseData(pqxx::row row) const override
+        shared_ptr<TransactionSummary> summary;
+        shared_ptr<TransactionColumns> columns;
+        shared_ptr<TransactionPartitions> partitions;
+        shared_ptr<VelocityTracker> velocity = make_shared<VelocityTracker>();
+        shared_ptr<TransactionArchive> archive;
+
+        // the SQLSTATE of a broken CHECK constraint, i.e. a balance that would go below zero
+        inline static const string checkViolation = "23514";
+
+        // the amount in the currency of the velocity limits
+        double getLimitAmount(const string &currencyCode, double amount, time_point<system_clock> at) const
+        {
+            return currencyCode == VelocityTracker::limitCurrency ? amount : amount * exchangeEntity.getRate(currencyCode, VelocityTracker::limitCurrency, at);
+        }
+        // one archive per database, so databases run from the same directory do not read each other's segments;
+        // the in-memory engine starts over every time, and so does its archive
+        static shared_ptr<TransactionArchive> openArchive(Storage &storage)
+        {
+            auto connection = storage.getConnection().lock();
+            if (!connection)
+                return make_shared<TransactionArchive>(TransactionArchive::getDefaultDirectory() + "/memory", true);
+            string databaseName = connection->dbname();
+            if (databaseName.empty() || databaseName == "." || databaseName == ".." || databaseName.find_first_of("/\\:") != string::npos)
+                throw(ValidationException("The database name " + databaseName + " can not name an archive directory!"));
+            return make_shared<TransactionArchive>(TransactionArchive::getDefaultDirectory() + "/postgres/" + databaseName);
+        }
+        void appendColumns(long long id, const Transaction &transaction, long long inboundId, long long outboundId)
+        {
+            columns->append(id, inboundId, outboundId, transaction.getInbound().getCurrency().getCode(), transaction.getOutbound().getCurrency().getCode(),
+                            transaction.getAmount(), transaction.getRate(), transaction.getDate());
+        }
+        // the transactions of deleted accounts leave their counterparties' balances behind, so they are moved into
+        // the counterparties' opening balances, keeping balances equal to the opening balance plus the transactions,
+        // and taken out of their daily summaries. Everything runs as a single statement, so the delete is atomic and
+        // the accounts' rows are read once; returns the ids of the deleted transactions and accounts, and of the
+        // counterparties. The summaries are locked first, so a concurrent refresh can not fold in a transaction
+        // this statement no longer sees as summarized
+        tuple<vector<long long>, vector<long long>, vector<long long>> deleteAccountsFromDatabase(const string &accountFilter, const string &userFilter)
+        {
+            string query =
+                TransactionSummary::lockQuery +
+                "WITH doomed AS (SELECT id FROM accounts WHERE " + accountFilter + " FOR UPDATE), "
+                "removed AS (DELETE FROM transactions t USING doomed d WHERE t.inbound = d.id OR t.outbound = d.id "
+                "RETURNING t.id, t.inbound, t.outbound, t.amount, t.rate, t.date, t.summarized), "
+                "changes AS (SELECT outbound AS account, -amount AS change FROM removed UNION ALL SELECT inbound, amount * rate FROM removed), "
+                "folded AS (UPDATE accounts a SET opening = a.opening + c.change FROM ("
+                "SELECT account, sum(change) AS change FROM changes WHERE account NOT IN (SELECT id FROM doomed) GROUP BY account"
+                ") c WHERE a.id = c.account RETURNING a.id), "
+                "summarized AS (SELECT r.* FROM removed r WHERE r.summarized), "
+                "movements AS (SELECT inbound AS account, date::date AS day, amount * rate AS inboundamount, 1 AS inboundcount, 0.0 AS outboundamount, 0 AS outboundcount "
+                "FROM summarized UNION ALL SELECT outbound, date::date, 0.0, 0, amount, 1 FROM summarized), "
+                "unsummarized AS (UPDATE transactiondailysummaries s SET inboundamount = s.inboundamount - m.inboundamount, inboundcount = s.inboundcount - m.inboundcount, "
+                "outboundamount = s.outboundamount - m.outboundamount, outboundcount = s.outboundcount - m.outboundcount FROM ("
+                "SELECT account, day, sum(inboundamount) AS inboundamount, sum(inboundcount) AS inboundcount, sum(outboundamount) AS outboundamount, "
+                "sum(outboundcount) AS outboundcount FROM movements WHERE account NOT IN (SELECT id FROM doomed) GROUP BY account, day"
+                ") m WHERE s.account = m.account AND s.day = m.day), "
+                "deletedaccounts AS (DELETE FROM accounts a USING doomed d WHERE a.id = d.id RETURNING a.id)" +
+                (userFilter.empty() ? "" : ", deletedusers AS (DELETE FROM users WHERE " + userFilter + ")") +
+                " SELECT 0, id FROM removed UNION ALL SELECT 1, id FROM deletedaccounts UNION ALL SELECT 2, id FROM folded;";
+
+            tuple<vector<long long>, vector<long long>, vector<long long>> deleted;
+            ReadSession::recordWrite();
+            for (const auto &row : Query(storage->getConnection(), query).execute())
+            {
+                auto id = row[1].as<long long>();
+                switch (row[0].as<int>())
+                {
+                case 0:
+                    get<0>(deleted).emplace_back(id);
+                    break;
+                case 1:
+                    get<1>(deleted).emplace_back(id);
+                    break;
+                default:
+                    get<2>(deleted).emplace_back(id);
+                }
+            }
+            return deleted;
+        }
+        void addToOpeningBalances(const map<long long, double> &openingChanges)
+        {
+            for (const auto &change : openingChanges)
+            {
+                double opening = 0;
+                storage->findByKey("accounts", change.first, [&opening](const Record &record)
+                                   { opening = record.get<double>(7); });
+                storage->update("accounts", change.first, {{"opening", std::format("{}", opening + change.second)}});
+            }
+        }
+        // the same through the storage engine, one row at a time
+        tuple<vector<long long>, vector<long long>, vector<long long>> deleteAccountsFromStorage(const string &property, long long value, long long userId)
+        {
+            vector<long long> accountIds;
+            storage->findByIndex("accounts", {{property, keyToString(value)}}, [&accountIds](const Record &record)
+                                 { accountIds.emplace_back(record.get<long long>(0)); });
+            set<long long> doomed(accountIds.begin(), accountIds.end());
+
+            set<long long> removed;
+            map<long long, double> openingChanges;
+            auto collect = [&removed, &doomed, &openingChanges](const Record &record)
+            {
+                if (!removed.insert(record.get<long long>(0)).second)
+                    return;
+                auto inboundId = record.get<long long>(1);
+                auto outboundId = record.get<long long>(2);
+                if (!doomed.contains(outboundId))
+                    openingChanges[outboundId] -= record.get<double>(3);
+                if (!doomed.contains(inboundId))
+                    openingChanges[inboundId] += record.get<double>(3) * record.get<double>(5);
+            };
+            for (auto accountId : accountIds)
+            {
+                storage->findByIndex(table, {{"inbound", keyToString(accountId)}}, collect);
+                storage->findByIndex(table, {{"outbound", keyToString(accountId)}}, collect);
+            }
+            vector<long long> counterpartyIds;
+            for (const auto &change : openingChanges)
+                counterpartyIds.emplace_back(change.first);
+            addToOpeningBalances(openingChanges);
+            for (auto accountId : accountIds)
+            {
+                storage->erase(table, "inbound", keyToString(accountId));
+                storage->erase(table, "outbound", keyToString(accountId));
+                storage->erase("accounts", "id", keyToString(accountId));
+            }
+            if (userId >= 0)
+                storage->erase("users", "id", keyToString(userId));
+            return make_tuple(vector<long long>(removed.begin(), removed.end()), accountIds, counterpartyIds);
+        }
+        // deletes the accounts matching the property (with their user, if one is given), then evicts what was
+        // deleted from the caches instead of reloading them
+        void deleteAccounts(const string &property, long long value, long long userId = -1)
+        {
+            ScopedTimer timer(getOperationHistogram("deleteAccounts"));
+            TraceSpan span("entity", table, "deleteAccounts");
+            auto deleted = storage->getConnection().expired()
+                               ? deleteAccountsFromStorage(property, value, userId)
+                               : deleteAccountsFromDatabase(property + " = " + keyToString(value), userId < 0 ? "" : "id = " + keyToString(userId));
+            const auto &transactionIds = get<0>(deleted);
+            const auto &accountIds = get<1>(deleted);
+            const auto &counterpartyIds = get<2>(deleted);
+
+            evictRecordsById(transactionIds);
+            columns->eraseAccounts(set<long long>(accountIds.begin(), accountIds.end()));
+            accountEntity.evictRecordsById(accountIds);
+            for (auto accountId : accountIds)
+                summary->invalidateAccount(accountId);
+            for (auto accountId : counterpartyIds)
+                summary->invalidateAccount(accountId);
+            info("event=accounts.deleted accounts={} transactions={} counterparties={}", accountIds.size(), transactionIds.size(), counterpartyIds.size());
+        }
+
+        // without a database the totals are aggregated from the account's posting list in the columns
+        vector<MonthlyTotals> aggregateMonthlyTotals(long long accountId)
         {
-            auto id = row[0].as<long long>();
-            auto inboundId = row[1].as<long long>();
-            auto outboundId = row[2].as<long long>();
-            auto amount = row[3].as<double>();
-            auto dateString = row[4].as<string>();
+            map<string, MonthlyTotals> months;
+            columns->forEachAccountRow(accountId, [&months](bool isInbound, double amount, double rate, int64_t timestamp)
+                                       {
+                                           auto month = std::format("{:%Y-%m}", time_point<system_clock>(seconds(timestamp)));
+                                           auto &totals = months.try_emplace(month, month, 0, 0, 0, 0).first->second;
+                                           if (isInbound)
+                                               totals.add(amount * rate, 1, 0, 0);
+                                           else
+                                               totals.add(0, 0, amount, 1); });
 
-            auto date = stringToTimePoint(dateString);
-            auto inbound = accountEntity.getRecordById(inboundId, true);
-            auto outbound = accountEntity.getRecordById(outboundId, true);
-            Transaction transaction(inbound.second, outbound.second, amount, date);
-            return pair<long long, Transaction>(id, transaction);
+            vector<MonthlyTotals> totals;
+            for (auto &month : months)
+                totals.emplace_back(move(month.second));
+            return totals;
+        }
+
+        // transactions of deleted accounts are not shown, as with the archived ones
+        bool isStale(const Record &record) const override
+        {
+            const auto &column = binding.bind(record);
+            return !accountEntity.isCached(record.get<long long>(column[1])) || !accountEntity.isCached(record.get<long long>(column[2]));
+        }
+        pair<long long, Transaction> parseData(const Record &record) const override
+        {
+            const auto &column = binding.bind(record);
+            const auto &inbound = accountEntity.getCachedData(record.get<long long>(column[1]));
+            const auto &outbound = accountEntity.getCachedData(record.get<long long>(column[2]));
+            return pair<long long, Transaction>(piecewise_construct, forward_as_tuple(record.get<long long>(column[0])),
+                                                forward_as_tuple(inbound, outbound, record.get<double>(column[3]), record.get<time_point<system_clock>>(column[4]),
+                                                                 record.get<double>(column[5])));
         }
 
     public:
-        TransactionEntity(weak_ptr<pqxx::connection> connection, AccountEntity &accountEntity, ExchangeEntity &exchangeEntity)
-            : Entity::Entity(connection, "transactions"),
-              accountEntity(accountEntity), exchangeEntity(exchangeEntity) {}
+        TransactionEntity(shared_ptr<Storage> storage, AccountEntity &accountEntity, ExchangeEntity &exchangeEntity)
+            : Entity::Entity(storage, "transactions", {"id", "inbound", "outbound", "amount", "date", "rate"}),
+              accountEntity(accountEntity), exchangeEntity(exchangeEntity),
+              summary(make_shared<TransactionSummary>(storage->getConnection())), columns(make_shared<TransactionColumns>()),
+              partitions(make_shared<TransactionPartitions>(storage->getConnection())), archive(openArchive(*storage)) {}
         ~TransactionEntity() = default;
 
-        pair<long long, Transaction> createTransaction(long long userId, string inboundIBAN, string outboundIBAN, double amount)
+        // a single scan fills both the cache and the columns
+        void loadData() override
         {
-            auto inbound = accountEntity.getAccountFromIBAN(inboundIBAN);
-            auto outbound = accountEntity.getAccountFromIBAN(outboundIBAN);
+            ScopedTimer timer(getOperationHistogram("load"));
+            TraceSpan span("entity", table, "load");
+            map<long long, Transaction> loadedData;
+            columns->clear();
+            storage->scan(table, [this, &loadedData](const Record &record)
+                          {
+                              auto entry = parseData(record);
+                              appendColumns(entry.first, entry.second, record.get<long long>(binding[1]), record.get<long long>(binding[2]));
+                              loadedData.emplace_hint(loadedData.end(), move(entry)); });
+            data = move(loadedData);
+        }
 
-            auto userAccounts = accountEntity.getUserAccounts(userId);
+        // the three lookups are in flight together, and the balances and the new row are written in a single batch,
+        // which commits as one transaction. The balances are changed relative to what they hold when the batch runs,
+        // so transfers made by other processes are not overwritten; the cached balance is only a first check, the
+        // accounts' CHECK constraint rejects a transfer that would still overdraw
+        Task<pair<long long, Transaction>> createTransactionAsync(long long userId, string inboundIBAN, string outboundIBAN, double amount)
+        {
+            ScopedTimer timer(getOperationHistogram("create"));
+            TraceSpan span("entity", table, "create");
+            auto lookups = co_await whenAll(accountEntity.getAccountFromIBANAsync(inboundIBAN), accountEntity.getAccountFromIBANAsync(outboundIBAN),
+                                            accountEntity.getUserAccountsAsync(userId));
+            const auto &inbound = get<0>(lookups);
+            const auto &outbound = get<1>(lookups);
+            const auto &userAccounts = get<2>(lookups);
             if (userAccounts.find(outbound.first) == userAccounts.end())
                 throw(InvalidBusinessLogicException("You may only transfer money from your own account!"));
 
-            auto inboundCurrency = inbound.second.getCurrency();
-            auto outboundCurrency = outbound.second.getCurrency();
-            auto exchange = exchangeEntity.getExchangeFromCurrencyCodes(outboundCurrency.getCode(), inboundCurrency.getCode());
-
-            auto rate = exchange.second.getRate();
-            auto newOutboundAmount = outbound.second.getAmount() - amount;
-            if (newOutboundAmount < 0)
+            // the rate is recorded with the transaction, so it can be valued later without the rate history; the
+            // date is stored to the second
+            auto now = floor<seconds>(system_clock::now());
+            auto rate = exchangeEntity.getRate(outbound.second.getCurrency().getCode(), inbound.second.getCurrency().getCode(), now);
+            if (outbound.second.getAmount() - amount < 0)
                 throw(InvalidBusinessLogicException("Insufficient funds for transaction!"));
-            auto newInboundAmount = inbound.second.getAmount() + amount * rate;
+            auto limitAmount = getLimitAmount(outbound.second.getCurrency().getCode(), amount, now);
+            velocity->check(outbound.first, userId, limitAmount, now);
 
-            accountEntity.updateAccountAmount(inbound.first, newInboundAmount);
-            accountEntity.updateAccountAmount(outbound.first, newOutboundAmount);
+            if (partitions->isAvailable())
+                partitions->ensurePartition(now);
 
-            auto now = system_clock::now();
-            string nowString = std::format("{:%F %T}", now);
-
-            Query query(connection, "INSERT INTO :table VALUES (DEFAULT, :inbound, :outbound, :amount, :date);");
-            query.setParameter<string>("table", table, false)
-                .setParameter<long long>("inbound", inbound.first)
-                .setParameter<long long>("outbound", outbound.first)
-                .setParameter<double>("amount", amount)
-                .setParameter<string>("date", nowString);
-            query.execute();
+            // the id and the balances come back from the batch, and the rows are cached from them rather than read back
+            vector<RowChange> changes;
+            changes.emplace_back("accounts", inbound.first, "amount", amount * rate);
+            changes.emplace_back("accounts", outbound.first, "amount", -amount);
+            changes.emplace_back(table, RecordValues{{"inbound", to_string(inbound.first)},
+                                                     {"outbound", to_string(outbound.first)},
+                                                     {"amount", std::format("{}", amount)},
+                                                     {"date", TimestampCodec::format(now)},
+                                                     {"rate", std::format("{}", rate)}});
+            AppliedChanges applied;
+            try
+            {
+                applied = co_await storage->applyAsync(move(changes));
+            }
+            catch (pqxx::sql_error const &sqlError)
+            {
+                if (sqlError.sqlstate() == checkViolation)
+                    throw(InvalidBusinessLogicException("Insufficient funds for transaction!"));
+                throw;
+            }
+            auto id = applied.getInsertedKey();
+            accountEntity.cacheAccountAmount(inbound.first, applied.getIncrementedValues()[0]);
+            accountEntity.cacheAccountAmount(outbound.first, applied.getIncrementedValues()[1]);
 
-            auto entry = getRecordByProperty("date", nowString);
+            auto inboundAccount = accountEntity.getRecordById(inbound.first, true).second;
+            auto outboundAccount = accountEntity.getRecordById(outbound.first, true).second;
+            auto entry = make_pair(id, Transaction(inboundAccount, outboundAccount, amount, now, rate));
             data.insert(entry);
-            return entry;
+            appendColumns(entry.first, entry.second, inbound.first, outbound.first);
+            velocity->record(outbound.first, userId, limitAmount, now);
+            summary->invalidateAccount(inbound.first);
+            summary->invalidateAccount(outbound.first);
+            co_return entry;
+        }
+        pair<long long, Transaction> createTransaction(long long userId, string inboundIBAN, string outboundIBAN, double amount)
+        {
+            return EventLoop::getInstance().run(createTransactionAsync(userId, inboundIBAN, outboundIBAN, amount));
+        }
+        // the velocity counters only need the transfers of the longest window, which are read from its partitions
+        void rebuildVelocity()
+        {
+            ScopedTimer timer(getOperationHistogram("rebuildVelocity"));
+            TraceSpan span("entity", table, "rebuildVelocity");
+            velocity->clear();
+            unordered_map<long long, long long> owners;
+            storage->scan("accounts", [&owners](const Record &record)
+                          { owners.emplace(record.get<long long>(0), record.get<long long>(2)); });
+
+            auto now = system_clock::now();
+            long long transfers = 0;
+            storage->findByRange(table, {}, "date", TimestampCodec::format(now - VelocityTracker::getLongestWindow()),
+                                 TimestampCodec::format(now + VelocityTracker::getLongestWindow()), [&](const Record &record)
+                                 {
+                                     auto entry = parseData(record);
+                                     auto outboundId = record.get<long long>(binding[2]);
+                                     auto owner = owners.find(outboundId);
+                                     if (owner == owners.end())
+                                         return;
+                                     const auto &transaction = entry.second;
+                                     velocity->record(outboundId, owner->second, getLimitAmount(transaction.getOutbound().getCurrency().getCode(), transaction.getAmount(), transaction.getDate()),
+                                                      transaction.getDate());
+                                     transfers++; });
+            info("event=velocity.rebuilt transfers={}", transfers);
         }
+        // monthly inbound and outbound totals of an account, oldest month first
+        vector<MonthlyTotals> getMonthlyTotals(long long accountId)
+        {
+            ScopedTimer timer(getOperationHistogram("monthlyTotals"));
+            TraceSpan span("entity", table, "monthlyTotals");
+            auto cached = summary->getCachedMonthlyTotals(accountId);
+            if (cached != nullptr)
+                return *cached;
+            return summary->cacheMonthlyTotals(accountId, summary->isAvailable() ? summary->getMonthlyTotals(accountId) : aggregateMonthlyTotals(accountId));
+        }
+        // totals of all transactions made in [from, to), by outbound currency
+        map<string, AmountTotals> getTotalsByCurrency(time_point<system_clock> from, time_point<system_clock> to) const
+        {
+            ScopedTimer timer(getOperationHistogram("totalsByCurrency"));
+            TraceSpan span("entity", table, "totalsByCurrency");
+            return columns->getTotalsByCurrency(from, to);
+        }
+        // the inbound and outbound queries are in flight together
+        Task<pair<map<long long, Transaction>, map<long long, Transaction>>> getAccountTransactionsAsync(long long accountId)
+        {
+            map<string, string> inbound = {{"inbound", keyToString(accountId)}}, outbound = {{"outbound", keyToString(accountId)}};
+            auto transactions = co_await whenAll(getRecordsByPropertyAsync(inbound), getRecordsByPropertyAsync(outbound));
+            co_return make_pair(move(get<0>(transactions)), move(get<1>(transactions)));
+        }
+        // read-only, so a replica may serve it
         pair<map<long long, Transaction>, map<long long, Transaction>> getAccountTransactions(long long accountId)
         {
-            auto inboundTransactions = getRecordsByProperty("inbound", keyToString(accountId));
-            auto outboundTransactions = getRecordsByProperty("outbound", keyToString(accountId));
-            return make_pair(inboundTransactions, outboundTransactions);
+            ReadSession::ReplicaScope replicaScope;
+            return EventLoop::getInstance().run(getAccountTransactionsAsync(accountId));
         }
-    };
+        // only reads the partitions of the months in [from, to), and the archive segments when the range reaches into them
+        Task<pair<map<long long, Transaction>, map<long long, Transaction>>> getAccountTransactionsAsync(long long accountId, time_point<system_clock> from,
+                                                                                                         time_point<system_clock> to)
+        {
+            auto fromString = TimestampCodec::format(from);
+            auto toString = TimestampCodec::format(to);
+            map<string, string> inbound = {{"inbound", keyToString(accountId)}}, outbound = {{"outbound", keyToString(accountId)}};
+            auto transactions = co_await whenAll(getRecordsInRangeAsync(inbound, "date", fromString, toString), getRecordsInRangeAsync(outbound, "date", fromString, toString));
+            auto &inboundTransactions = get<0>(transactions);
+            auto &outboundTransactions = get<1>(transactions);
 
-    class AccountTransactionEntity : public AccountEntity, public TransactionEntity
-    {
-    public:
-        AccountTransactionEntity(AccountEntity &accountEntity, TransactionEntity &transactionEntity) : AccountEntity(accountEntity), TransactionEntity(transactionEntity) {}
+            auto fromSecond = duration_cast<seconds>(from.time_since_epoch()).count();
+            if (fromSecond < archive->getEnd())
+                archive->forEach(accountId, fromSecond, duration_cast<seconds>(to.time_since_epoch()).count(), [&](const ArchivedTransaction &row)
+                                 {
+                                     // transactions of deleted accounts are not shown, as with the ones still in the table
+                                     if (!accountEntity.isCached(row.getInboundId()) || !accountEntity.isCached(row.getOutboundId()))
+                                         return;
+                                     auto inbound = accountEntity.getRecordById(row.getInboundId(), true);
+                                     auto outbound = accountEntity.getRecordById(row.getOutboundId(), true);
+                                     Transaction transaction(inbound.second, outbound.second, row.getAmount(), time_point<system_clock>(seconds(row.getTimestamp())), row.getRate());
+                                     (row.getInboundId() == accountId ? inboundTransactions : outboundTransactions).emplace(row.getId(), transaction); });
+            co_return make_pair(move(inboundTransactions), move(outboundTransactions));
+        }
+        pair<map<long long, Transaction>, map<long long, Transaction>> getAccountTransactions(long long accountId, time_point<system_clock> from, time_point<system_clock> to)
+        {
+            ReadSession::ReplicaScope replicaScope;
+            return EventLoop::getInstance().run(getAccountTransactionsAsync(accountId, from, to));
+        }
+        const vector<SegmentHeader> &getArchiveSegments() const { return archive->getSegments(); }
+        // moves the transactions made before the cutoff out of the table, into a new archive segment, and folds them
+        // into the opening balances of their accounts; the segment is on disk before anything is deleted, rows found
+        // in the archive already (left behind by an archival that failed halfway) are not written again, and the daily
+        // summaries are brought up to date in the same transaction as the delete, so they keep the archived rows
+        pair<long long, string> archiveTransactions(time_point<system_clock> cutoff)
+        {
+            if (cutoff > floor<days>(system_clock::now()))
+                throw(InvalidBusinessLogicException("Only transactions made before today may be archived!"));
+            ScopedTimer timer(getOperationHistogram("archive"));
+            TraceSpan span("entity", table, "archive");
+            auto cutoffString = TimestampCodec::format(cutoff);
+            auto cutoffSecond = duration_cast<seconds>(cutoff.time_since_epoch()).count();
+
+            set<long long> archived;
+            archive->forEach(-1, numeric_limits<int64_t>::min(), cutoffSecond, [&archived](const ArchivedTransaction &row)
+                             { archived.insert(row.getId()); });
+            vector<ArchivedTransaction> rows;
+            vector<long long> removedIds;
+            map<long long, double> openingChanges;
+            set<long long> accountIds;
+            storage->findByRange(table, {}, "date", "-infinity", cutoffString, [&](const Record &record)
+                                 {
+                                     auto id = record.get<long long>(0);
+                                     auto inboundId = record.get<long long>(1);
+                                     auto outboundId = record.get<long long>(2);
+                                     auto amount = record.get<double>(3);
+                                     auto rate = record.get<double>(5);
+                                     removedIds.emplace_back(id);
+                                     openingChanges[outboundId] -= amount;
+                                     openingChanges[inboundId] += amount * rate;
+                                     accountIds.insert(inboundId);
+                                     accountIds.insert(outboundId);
+                                     if (!archived.contains(id))
+                                         rows.emplace_back(id, inboundId, outboundId, amount, rate,
+                                                           duration_cast<seconds>(record.get<time_point<system_clock>>(4).time_since_epoch()).count()); });
+            if (removedIds.empty())
+                return make_pair(0, "");
+
+            string segmentPath;
+            if (!rows.empty())
+                segmentPath = archive->append(move(rows)).getPath();
+            if (storage->getConnection().expired())
+            {
+                addToOpeningBalances(openingChanges);
+                for (auto id : removedIds)
+                    storage->erase(table, "id", keyToString(id));
+            }
+            else
+            {
+                // only the rows read above, a transaction committed since then is not in the segment
+                string ids = "{";
+                for (auto id : removedIds)
+                    ids += (ids.size() > 1 ? "," : "") + to_string(id);
+                ids += "}";
+                Query query(storage->getConnection(), TransactionSummary::getRefreshQuery() +
+                                                          "WITH removed AS (DELETE FROM transactions WHERE date < :cutoff AND id = ANY(CAST(:ids AS bigint[])) "
+                                                          "RETURNING inbound, outbound, amount, rate), "
+                                                          "changes AS (SELECT outbound AS account, -amount AS change FROM removed UNION ALL SELECT inbound, amount * rate FROM removed) "
+                                                          "UPDATE accounts a SET opening = a.opening + c.change FROM ("
+                                                          "SELECT account, sum(change) AS change FROM changes GROUP BY account) c WHERE a.id = c.account;");
+                query.setParameter<string>("cutoff", cutoffString).setParameter<string>("ids", ids);
+                ReadSession::recordWrite();
+                query.execute();
+            }
 
-        void deleteRecordById(long long accountId) override
+            evictRecordsById(removedIds);
+            columns->eraseBefore(cutoffSecond);
+            for (auto accountId : accountIds)
+                summary->invalidateAccount(accountId);
+            info("event=transactions.archived cutoff=\"{}\" transactions={} segment={}", cutoffString, removedIds.size(), segmentPath);
+            return make_pair(static_cast<long long>(removedIds.size()), segmentPath);
+        }
+        vector<TransactionPartition> getPartitions() const { return partitions->getPartitions(); }
+        void deleteAccount(long long accountId) { deleteAccounts("id", accountId); }
+        // the user's accounts and the user are deleted together
+        void deleteUserAccounts(long long userId) { deleteAccounts("associatedUser", userId, userId); }
+        // the detached transactions are dropped from the cache and the columns, the daily summaries keep them, as they
+        // are brought up to date in the same transaction
+        string detachPartition(const string &month)
         {
-            TransactionEntity::deleteRecordsByProperty("inbound", TransactionEntity::keyToString(accountId));
-            TransactionEntity::deleteRecordsByProperty("outbound", TransactionEntity::keyToString(accountId));
-            AccountEntity::deleteRecordById(accountId);
+            ReadSession::recordWrite();
+            auto partitionName = partitions->detachPartition(month);
+            loadData();
+            return partitionName;
         }
     };
 
@@ -439,7 +1071,7 @@ namespace database
         static shared_ptr<DatabaseManager> instance;
         static once_flag only_one;
 
-        shared_ptr<pqxx::connection> connection;
+        shared_ptr<Storage> storage;
 
         CurrencyEntity currencyEntity;
         ExchangeEntity exchangeEntity;
@@ -447,48 +1079,20 @@ namespace database
         UserEntity userEntity;
         AccountEntity accountEntity;
         TransactionEntity transactionEntity;
-        AccountTransactionEntity accountTransactionEntity;
-
-        // SQL utility functions
-        void initializeDatabase(ifstream &file, char fileSeparator = ';')
-        {
-            try
-            {
-                vector<string> queries;
-                for (string query; getline(file, query, fileSeparator);)
-                    if (!query.empty())
-                    {
-                        try
-                        {
-                            string finalQuery = query + fileSeparator;
-                            Query query(connection, finalQuery);
-                            query.execute();
-                        }
-                        catch (pqxx::sql_error const &sqlError)
-                        {
-                            error("SQL error: " + string(sqlError.what()));
-                        }
-                    }
-            }
-            catch (std::exception const &exception)
-            {
-                error("Unexpected exception: " + string(exception.what()));
-            }
-        }
+        StatementExporter statementExporter;
+        BalanceReconciler balanceReconciler;
 
     public:
-        DatabaseManager(shared_ptr<pqxx::connection> connection, string initializationFilePath) : connection(connection),
-                                                                                                  currencyEntity(connection), countryEntity(connection),
-                                                                                                  exchangeEntity(connection, currencyEntity), userEntity(connection, countryEntity),
-                                                                                                  accountEntity(connection, currencyEntity, userEntity, transactionEntity), transactionEntity(connection, accountEntity, exchangeEntity),
-                                                                                                  accountTransactionEntity(accountEntity, transactionEntity)
+        DatabaseManager(shared_ptr<Storage> storage, string initializationFilePath) : storage(storage),
+                                                                                      currencyEntity(storage), countryEntity(storage),
+                                                                                      exchangeEntity(storage, currencyEntity), userEntity(storage, countryEntity),
+                                                                                      accountEntity(storage, currencyEntity, userEntity, transactionEntity), transactionEntity(storage, accountEntity, exchangeEntity),
+                                                                                      statementExporter(storage), balanceReconciler(storage)
         {
-            info("Database connection opened.");
-
             // initialize database
             ifstream initializationFile;
             initializationFile.open(initializationFilePath, ios_base::in);
-            initializeDatabase(initializationFile);
+            storage->initialize(initializationFile);
             initializationFile.close();
 
             currencyEntity.loadData();
@@ -497,11 +1101,22 @@ namespace database
             userEntity.loadData();
             accountEntity.loadData();
             transactionEntity.loadData();
+            transactionEntity.rebuildVelocity();
         }
+        DatabaseManager(shared_ptr<pqxx::connection> connection, string initializationFilePath)
+            : DatabaseManager(make_shared<PostgresStorage>(connection), initializationFilePath) {}
+        // writes go to the primary, the reads of read-only operations to the replicas
+        DatabaseManager(string connectionString, vector<string> replicaConnectionStrings, string initializationFilePath)
+            : DatabaseManager(PostgresStorage::connect(connectionString, replicaConnectionStrings), initializationFilePath) {}
         ~DatabaseManager()
         {
-            connection.get()->close();
-            info("Database connection closed.");
+            for (const auto &histogram : MetricsRegistry::getInstance().getHistograms())
+                if (histogram.first.starts_with("query.") && histogram.second->getCount() > 0)
+                    info("event=latency.summary histogram={} count={} mean_us={} p50_us={} p99_us={} max_us={}", histogram.first, histogram.second->getCount(),
+                         duration_cast<microseconds>(histogram.second->getMean()).count(),
+                         duration_cast<microseconds>(histogram.second->getPercentile(50)).count(),
+                         duration_cast<microseconds>(histogram.second->getPercentile(99)).count(),
+                         duration_cast<microseconds>(histogram.second->getMaximum()).count());
         }
 
         DatabaseManager &operator=(const DatabaseManager &databaseManager)
@@ -523,12 +1138,21 @@ namespace database
             return *DatabaseManager::instance;
         }
 
-        CurrencyEntity getCurrencyEntity() { return currencyEntity; }
-        ExchangeEntity getExchangeEntity() { return exchangeEntity; }
-        CountryEntity getCountryEntity() { return countryEntity; }
-        UserEntity getUserEntity() { return userEntity; }
-        AccountEntity getAccountEntity() { return accountEntity; }
-        TransactionEntity getTransactionEntity() { return transactionEntity; }
-        AccountTransactionEntity getAccountTransactionEntity() { return accountTransactionEntity; }
+        Storage &getStorage() { return *storage; }
+        CurrencyEntity &getCurrencyEntity() { return currencyEntity; }
+        ExchangeEntity &getExchangeEntity() { return exchangeEntity; }
+        CountryEntity &getCountryEntity() { return countryEntity; }
+        UserEntity &getUserEntity() { return userEntity; }
+        AccountEntity &getAccountEntity() { return accountEntity; }
+        TransactionEntity &getTransactionEntity() { return transactionEntity; }
+        // the user, their accounts and the accounts' transactions are deleted together, in a single statement
+        void deleteUser(long long userId)
+        {
+            transactionEntity.deleteUserAccounts(userId);
+            userEntity.evictRecordsById({userId});
+        }
+
+        const StatementExporter &getStatementExporter() const { return statementExporter; }
+        BalanceReconciler &getBalanceReconciler() { return balanceReconciler; }
     };
 }
\ No newline at end of file
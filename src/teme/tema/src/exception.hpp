@@ -76,6 +76,27 @@ namespace exception
         UserQuitException() : logic_error("User quit!") {}
     };
 
+    class ServerException : public runtime_error
+    {
+    public:
+        ServerException() : runtime_error("Server error!") {}
+        ServerException(string message) : runtime_error(message) { error(message); }
+    };
+
+    class VelocityLimitExceededException : public logic_error
+    {
+    public:
+        VelocityLimitExceededException() : logic_error("Transfer limit exceeded!") {}
+        VelocityLimitExceededException(string message) : logic_error(message) { warn(message); }
+    };
+
+    class StorageOperationUnsupportedException : public logic_error
+    {
+    public:
+        StorageOperationUnsupportedException() : logic_error("Operation not supported by the storage engine!") {}
+        StorageOperationUnsupportedException(string message) : logic_error(message) { warn(message); }
+    };
+
     class IdentifierNotFoundException : public logic_error
     {
     public:
@@ -0,0 +1,80 @@
+#include <string>
+#include <format>
+#include <ostream>
+#include <iterator>
+#include <filesystem>
+
+using namespace std;
+using namespace tracing;
+using namespace exception;
+
+namespace formatting
+{
+    // formats rows into a buffer that is reused between commands, and only writes to the
+    // underlying stream once the buffer is large enough (or when the rows are done)
+    class OutputBuffer
+    {
+    private:
+        inline static const size_t defaultFlushThreshold = 64 * 1024;
+
+        // covers formatting the rows and writing them out, the buffer is flushed before the span ends
+        TraceSpan span;
+        ostream &output;
+        string &buffer;
+        size_t flushThreshold;
+        long long flushedBytes = 0;
+
+    public:
+        OutputBuffer(ostream &output, string &buffer, size_t flushThreshold = defaultFlushThreshold) : span("output", "format"), output(output), buffer(buffer), flushThreshold(flushThreshold)
+        {
+            buffer.clear();
+            buffer.reserve(flushThreshold);
+        }
+        OutputBuffer(const OutputBuffer &) = delete;
+        ~OutputBuffer() { flush(); }
+
+        template <typename... ArgumentTypes>
+        OutputBuffer &write(format_string<ArgumentTypes...> format, ArgumentTypes &&...arguments)
+        {
+            format_to(back_inserter(buffer), format, std::forward<ArgumentTypes>(arguments)...);
+            if (buffer.size() >= flushThreshold)
+                flush();
+            return *this;
+        }
+        OutputBuffer &write(char character)
+        {
+            buffer.push_back(character);
+            return *this;
+        }
+        void flush()
+        {
+            if (buffer.empty())
+                return;
+            output.write(buffer.data(), buffer.size());
+            flushedBytes += buffer.size();
+            buffer.clear();
+        }
+        long long getWrittenBytes() const { return flushedBytes + buffer.size(); }
+    };
+
+    // files the application writes for its clients (exports, statistics, traces) only go into this directory, under
+    // a plain name; clients may be remote, and must not pick a path elsewhere on the server's filesystem
+    class OutputDirectory
+    {
+    private:
+        inline static string directory = "output";
+
+    public:
+        static void setDirectory(string newDirectory) { directory = newDirectory; }
+        static const string &getDirectory() { return directory; }
+
+        // the path of the named file, the directory is created when missing
+        static string resolve(const string &fileName)
+        {
+            if (fileName.empty() || fileName == "." || fileName == ".." || fileName.find_first_of("/\\:") != string::npos)
+                throw(ValidationException("Invalid file name " + fileName + ", only plain file names are allowed!"));
+            filesystem::create_directories(directory);
+            return (filesystem::path(directory) / fileName).string();
+        }
+    };
+};
\ No newline at end of file
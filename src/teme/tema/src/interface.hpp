@@ -1,6 +1,14 @@
 #include <map>
 #include <set>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <vector>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <numeric>
+#include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <functional>
@@ -9,6 +17,9 @@ using namespace std;
 using namespace spdlog;
 using namespace bank;
 using namespace database;
+using namespace formatting;
+using namespace metrics;
+using namespace tracing;
 
 #ifdef WIN32
 #include <windows.h>
@@ -22,6 +33,30 @@ using namespace database;
 namespace interface
 {
 
+    enum class CommandStatus
+    {
+        Succeeded,
+        Failed,
+        NotFound,
+        Unauthenticated
+    };
+
+    inline string commandStatusToString(CommandStatus status)
+    {
+        switch (status)
+        {
+        case CommandStatus::Succeeded:
+            return "ok";
+        case CommandStatus::Failed:
+            return "error";
+        case CommandStatus::NotFound:
+            return "not-found";
+        case CommandStatus::Unauthenticated:
+            return "unauthenticated";
+        }
+        return "unknown";
+    }
+
     class Command
     {
     private:
@@ -56,11 +91,22 @@ namespace interface
     class CLI
     {
     private:
-        DatabaseManager manager;
+        shared_ptr<DatabaseManager> manager;
         pair<long long, User> authenticatedUser;
         map<Command, function<void()>> commandMapping;
         bool isRunning;
 
+        // in batch mode input is consumed token by token from the current script line,
+        // and nothing touches the terminal
+        istream &input;
+        ostream &output;
+        bool interactive;
+        deque<string> pendingInput;
+        // reused by every command that prints rows
+        string outputBuffer;
+        // pins the session's reads to the primary after it writes
+        ReadSession readSession;
+
         inline static void clearUtility() { system(CLEAR_COMMAND); }
         inline static void setInputEcho(bool enable)
         {
@@ -85,12 +131,27 @@ namespace interface
         }
         string getInput(string message)
         {
-            string input;
-            cout << message;
-            cin >> input;
-            if (input == "exit")
-                this->exit();
-            return input;
+            string value;
+            if (interactive)
+            {
+                output << message << flush;
+                input >> value;
+            }
+            else
+            {
+                if (pendingInput.empty())
+                    throw(ValidationException("Missing value for \"" + message.substr(0, message.find(':')) + "\"."));
+                value = pendingInput.front();
+                pendingInput.pop_front();
+            }
+            return value;
+        }
+        // interactive sessions re-prompt on invalid input, scripts fail the current command
+        void rejectInput(string message)
+        {
+            if (!interactive)
+                throw(ValidationException(message));
+            output << message << '\n';
         }
 
         string emailUtility()
@@ -100,7 +161,7 @@ namespace interface
             {
                 email = getInput("Email: ");
                 if (!Validator::isEmail(email))
-                    cout << "The provided email is not valid." << endl;
+                    rejectInput("The provided email is not valid.");
                 else
                     break;
             }
@@ -111,16 +172,21 @@ namespace interface
             string password;
             while (true)
             {
-                setInputEcho(false);
-                password = getInput("Password: ");
-                setInputEcho(true);
+                if (interactive)
+                {
+                    setInputEcho(false);
+                    password = getInput("Password: ");
+                    setInputEcho(true);
+                    output << '\n';
+                }
+                else
+                    password = getInput("Password: ");
 
-                cout << endl;
                 if (validate)
                 {
                     if (!Validator::isPasswordStrong(password))
-                        cout << "The provided password does not match the strength criteria. "
-                             << "Please make sure your password contains at least 8 characters, one uppercase letter, one lowercase letter, one number and one special character." << endl;
+                        rejectInput("The provided password does not match the strength criteria. "
+                                    "Please make sure your password contains at least 8 characters, one uppercase letter, one lowercase letter, one number and one special character.");
                     else
                         break;
                 }
@@ -131,11 +197,14 @@ namespace interface
         }
         string countryCodeUtility()
         {
-            cout << "Please enter your country code. The available countries are:" << endl;
-            auto countryDisplayData = manager.getCountryEntity().getCountryDisplayData();
-            for (const auto &displayData : countryDisplayData)
-                cout << displayData.first << ": " << displayData.second << endl;
-            cout << endl;
+            auto countryDisplayData = manager->getCountryEntity().getCountryDisplayData();
+            if (interactive)
+            {
+                output << "Please enter your country code. The available countries are:" << '\n';
+                for (const auto &displayData : countryDisplayData)
+                    output << displayData.first << ": " << displayData.second << '\n';
+                output << '\n';
+            }
 
             set<string> countryCodes;
             for (const auto &displayData : countryDisplayData)
@@ -146,7 +215,7 @@ namespace interface
             {
                 countryCode = getInput("Country code: ");
                 if (find(countryCodes.begin(), countryCodes.end(), countryCode) == countryCodes.end())
-                    cout << "Please enter a valid country code." << endl;
+                    rejectInput("Please enter a valid country code.");
                 else
                     break;
             }
@@ -154,11 +223,14 @@ namespace interface
         }
         string currencyCodeUtility()
         {
-            cout << "Please enter the currency. The available currencies are:" << endl;
-            auto currencyDisplayData = manager.getCurrencyEntity().getCurrencyDisplayData();
-            for (const auto &displayData : currencyDisplayData)
-                cout << displayData.first << ": " << displayData.second << endl;
-            cout << endl;
+            auto currencyDisplayData = manager->getCurrencyEntity().getCurrencyDisplayData();
+            if (interactive)
+            {
+                output << "Please enter the currency. The available currencies are:" << '\n';
+                for (const auto &displayData : currencyDisplayData)
+                    output << displayData.first << ": " << displayData.second << '\n';
+                output << '\n';
+            }
 
             set<string> currencyCodes;
             for (const auto &displayData : currencyDisplayData)
@@ -169,7 +241,7 @@ namespace interface
             {
                 currencyCode = getInput("Currency code: ");
                 if (currencyCodes.find(currencyCode) == currencyCodes.end())
-                    cout << "Please enter a valid currency code." << endl;
+                    rejectInput("Please enter a valid currency code.");
                 else
                     break;
             }
@@ -178,12 +250,15 @@ namespace interface
 
         void clear()
         {
+            if (!interactive)
+                return;
             clearUtility();
-            cout << "Please enter your commands below." << endl;
+            output << "Please enter your commands below." << '\n';
         }
         void exit()
         {
-            clearUtility();
+            if (interactive)
+                clearUtility();
             isRunning = false;
         }
         void help()
@@ -198,66 +273,67 @@ namespace interface
                     noAuthenticationRequiredCommands.emplace_back(command.first);
             }
             this->clear();
-            cout << endl;
-            cout << "Commands that don't require authentication:" << endl;
+            output << '\n';
+            output << "Commands that don't require authentication:" << '\n';
             for (const auto &command : noAuthenticationRequiredCommands)
-                cout << command.getFormattedDescription() << endl;
-            cout << endl;
-            cout << "Commands that require authentication:" << endl;
+                output << command.getFormattedDescription() << '\n';
+            output << '\n';
+            output << "Commands that require authentication:" << '\n';
             for (const auto &command : authenticationRequiredCommands)
-                cout << command.getFormattedDescription() << endl;
+                output << command.getFormattedDescription() << '\n';
         }
+        // the administrator is told apart by the email the initialization script gives it, as its id
+        // depends on the engine and on when the database was created
+        bool isAdministrator() const { return authenticatedUser.first != -1 && authenticatedUser.second.getEmail() == User::administratorEmail; }
         void signup()
         {
             if (authenticatedUser.first != -1)
-                throw(runtime_error("An user is already logged in! Please log out first!"));
+                throw(InvalidBusinessLogicException("An user is already logged in! Please log out first!"));
             string email, firstName, lastName, password, countryCode;
             firstName = getInput("First name: ");
             lastName = getInput("Last name: ");
             email = emailUtility();
             password = passwordUtility();
             countryCode = countryCodeUtility();
-            auto user = manager.getUserEntity().createUser(countryCode, email, firstName, lastName, password);
+            auto user = manager->getUserEntity().createUser(countryCode, email, firstName, lastName, password);
             authenticatedUser = user;
-            cout << "You have successfully created an account!" << endl;
+            output << "You have successfully created an account!" << '\n';
         }
         void login()
         {
             if (authenticatedUser.first != -1)
-                throw(runtime_error("An user is already signed in! Please log out first!"));
+                throw(InvalidBusinessLogicException("An user is already signed in! Please log out first!"));
             string email, password;
             email = emailUtility();
             password = passwordUtility(false);
-            auto user = manager.getUserEntity().getUserFromEmail(email);
+            auto user = manager->getUserEntity().getUserFromEmail(email);
             if (user.second.authenticate(password))
             {
                 authenticatedUser = user;
-                cout << "You have successfully logged in!" << endl;
+                output << "You have successfully logged in!" << '\n';
             }
             else
-                cout << "Incorrect password!" << endl;
+                throw(InvalidBusinessLogicException("Incorrect password!"));
         }
         void logout()
         {
             authenticatedUser.first = -1;
-            cout << "You have successfully logged out!" << endl;
+            output << "You have successfully logged out!" << '\n';
         }
         void userInfo()
         {
-            cout << authenticatedUser.second;
+            output << authenticatedUser.second;
         }
         void userDelete()
         {
-            cout << "Are you sure you want to delete your account? [yes/no]" << endl;
+            if (interactive)
+                output << "Are you sure you want to delete your account? [yes/no]" << '\n';
             string confirmation = getInput("Confirm: ");
             if (confirmation == "yes" || confirmation == "y")
             {
-                auto accounts = manager.getAccountEntity().getUserAccounts(authenticatedUser.first);
-                for (auto const &account : accounts)
-                    manager.getAccountTransactionEntity().deleteRecordById(account.first);
-                manager.getUserEntity().deleteRecordById(authenticatedUser.first);
+                manager->deleteUser(authenticatedUser.first);
                 authenticatedUser = make_pair(-1, User());
-                cout << "Account deleted successfully!" << endl;
+                output << "Account deleted successfully!" << '\n';
             }
         }
         void addAccount()
@@ -267,36 +343,36 @@ namespace interface
             lastName = getInput("Account holder's last name: ");
             currencyCode = currencyCodeUtility();
 
-            pair<int, Account> account = manager.getAccountEntity().createAccount(currencyCode, authenticatedUser.first, firstName, lastName);
-            cout << "You have successfully created a bank account!" << endl;
+            pair<int, Account> account = manager->getAccountEntity().createAccount(currencyCode, authenticatedUser.first, firstName, lastName);
+            output << "You have successfully created a bank account!" << '\n';
         }
         void deleteAccount()
         {
             this->viewAccounts();
-            cout << endl;
+            output << '\n';
             string IBAN = getInput("IBAN: ");
 
-            auto account = manager.getAccountEntity().getAccountFromIBAN(IBAN);
-            auto accounts = manager.getAccountEntity().getUserAccounts(authenticatedUser.first);
+            auto account = manager->getAccountEntity().getAccountFromIBAN(IBAN);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
             if (accounts.find(account.first) == accounts.end())
                 throw(InvalidBusinessLogicException("You may only delete your own account!"));
-            manager.getAccountTransactionEntity().deleteRecordById(account.first);
-            cout << "You have successfully deleted your bank account" << endl;
+            manager->getTransactionEntity().deleteAccount(account.first);
+            output << "You have successfully deleted your bank account" << '\n';
         }
         void viewAccounts()
         {
-            auto accounts = manager.getAccountEntity().getUserAccounts(authenticatedUser.first);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+            OutputBuffer rows(output, outputBuffer);
             for (const auto &account : accounts)
-            {
-                cout << "Account " << account.second.getIBAN() << endl;
-                cout << account.second << endl;
-            }
+                rows.write("Account {}\nIBAN: {}\nAmount: {:f}\nCurrency: {}\nHolder full name: {}\n\n",
+                           account.second.getIBAN(), account.second.getIBAN(), account.second.getAmount(),
+                           account.second.getCurrency().getCode(), account.second.getFullName());
         }
         void addTransaction()
         {
-            cout << "Please select the account from which you want to make the transaction:" << endl;
+            output << "Please select the account from which you want to make the transaction:" << '\n';
             this->viewAccounts();
-            cout << endl;
+            output << '\n';
 
             string outboundIBAN, inboundIBAN, amountString;
             outboundIBAN = getInput("Your IBAN: ");
@@ -304,22 +380,22 @@ namespace interface
             amountString = getInput("Transaction amount: ");
 
             if (outboundIBAN == inboundIBAN)
-                throw(runtime_error("You can not make a transfer from an account to the same account."));
+                throw(InvalidBusinessLogicException("You can not make a transfer from an account to the same account."));
 
             double amount = stod(amountString);
-            manager.getTransactionEntity().createTransaction(authenticatedUser.first, inboundIBAN, outboundIBAN, amount);
-            cout << "Transaction successfully registered!" << endl;
+            manager->getTransactionEntity().createTransaction(authenticatedUser.first, inboundIBAN, outboundIBAN, amount);
+            output << "Transaction successfully registered!" << '\n';
         }
         void viewTransactions()
         {
 
-            cout << "Please select the account from which you want to make the transaction:" << endl;
+            output << "Please select the account from which you want to make the transaction:" << '\n';
             this->viewAccounts();
 
             string IBAN = getInput("IBAN: ");
 
             bool matches = false;
-            auto accounts = manager.getAccountEntity().getUserAccounts(authenticatedUser.first);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
             pair<int, Account> userAccount;
             for (const auto &account : accounts)
                 if (account.second.getIBAN() == IBAN)
@@ -331,49 +407,380 @@ namespace interface
             if (!matches)
                 throw(InvalidBusinessLogicException("IBAN does not exist, or it is not associated with one of your accounts."));
 
-            auto transactions = manager.getTransactionEntity().getAccountTransactions(userAccount.first);
-            vector<pair<time_point<system_clock>, string>> inboundTransactions, outboundTransactions;
+            printTransactions(manager->getTransactionEntity().getAccountTransactions(userAccount.first));
+        }
+        void viewHistory()
+        {
+            string IBAN = getInput("IBAN: ");
+            auto account = manager->getAccountEntity().getAccountFromIBAN(IBAN);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+            if (accounts.find(account.first) == accounts.end())
+                throw(InvalidBusinessLogicException("You may only view transactions of your own account!"));
+            auto from = dateUtility("From (YYYY-MM-DD): ");
+            auto to = dateUtility("To (YYYY-MM-DD, exclusive): ");
+
+            printTransactions(manager->getTransactionEntity().getAccountTransactions(account.first, from, to));
+        }
+        void printTransactions(const pair<map<long long, Transaction>, map<long long, Transaction>> &transactions)
+        {
+            // sort pointers to the fetched transactions, rows are formatted straight into the output buffer
+            vector<const Transaction *> inboundTransactions, outboundTransactions;
+            inboundTransactions.reserve(transactions.first.size());
+            outboundTransactions.reserve(transactions.second.size());
             for (const auto &transaction : transactions.first)
-                inboundTransactions.emplace_back(pair<time_point<system_clock>, string>(transaction.second.getDate(),
-                                                                                        "From " + transaction.second.getOutbound().getIBAN() +
-                                                                                            " recieved " + to_string(transaction.second.getAmount()) +
-                                                                                            " " + transaction.second.getOutbound().getCurrency().getCode() +
-                                                                                            " on " + transaction.second.getDateString()));
+                inboundTransactions.emplace_back(&transaction.second);
             for (const auto &transaction : transactions.second)
-                outboundTransactions.emplace_back(pair<time_point<system_clock>, string>(transaction.second.getDate(),
-                                                                                         "To " + transaction.second.getInbound().getIBAN() +
-                                                                                             " sent " + to_string(transaction.second.getAmount()) +
-                                                                                             " " + transaction.second.getOutbound().getCurrency().getCode() +
-                                                                                             " on " + transaction.second.getDateString()));
-
-            cout << endl;
+                outboundTransactions.emplace_back(&transaction.second);
+            auto byDate = [](const Transaction *first, const Transaction *second)
+            { return first->getDate() < second->getDate(); };
+            stable_sort(inboundTransactions.begin(), inboundTransactions.end(), byDate);
+            stable_sort(outboundTransactions.begin(), outboundTransactions.end(), byDate);
+
+            OutputBuffer rows(output, outputBuffer);
+            rows.write('\n');
             if (!inboundTransactions.empty())
             {
-                sort(inboundTransactions.begin(), inboundTransactions.end());
-                cout << "Inbound transactions: " << endl;
-                for (const auto &inboundTransaction : inboundTransactions)
-                    cout << inboundTransaction.second << endl;
+                rows.write("Inbound transactions: \n");
+                for (const auto transaction : inboundTransactions)
+                    rows.write("From {} recieved {:f} {} on {:%F %T}\n", transaction->getOutbound().getIBAN(), transaction->getAmount(),
+                               transaction->getOutbound().getCurrency().getCode(), transaction->getDate());
             }
             if (!outboundTransactions.empty())
             {
-                sort(outboundTransactions.begin(), outboundTransactions.end());
-                cout << endl
-                     << "Outbound transactions: " << endl;
-                for (const auto &outboundTransaction : outboundTransactions)
-                    cout << outboundTransaction.second << endl;
+                rows.write("\nOutbound transactions: \n");
+                for (const auto transaction : outboundTransactions)
+                    rows.write("To {} sent {:f} {} on {:%F %T}\n", transaction->getInbound().getIBAN(), transaction->getAmount(),
+                               transaction->getOutbound().getCurrency().getCode(), transaction->getDate());
             }
             if (inboundTransactions.empty() && outboundTransactions.empty())
-                cout << "There are no transactions associated with this account." << endl;
+                rows.write("There are no transactions associated with this account.\n");
+        }
+        ExportFormat exportFormatUtility()
+        {
+            while (true)
+            {
+                string format = getInput("Format (csv/jsonl): ");
+                if (format == "csv")
+                    return ExportFormat::CSV;
+                if (format == "jsonl")
+                    return ExportFormat::JSONLines;
+                rejectInput("Please enter a valid export format.");
+            }
+        }
+        void exportAccount()
+        {
+            string IBAN = getInput("IBAN: ");
+            auto account = manager->getAccountEntity().getAccountFromIBAN(IBAN);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+            if (accounts.find(account.first) == accounts.end())
+                throw(InvalidBusinessLogicException("You may only export transactions from your own account!"));
+            auto format = exportFormatUtility();
+            string fileName = getInput("File name: ");
+
+            auto summary = manager->getStatementExporter().exportAccountTransactions(account.first, format, fileName);
+            output << "Exported " << summary.getDescription() << " to " << fileName << " in " << OutputDirectory::getDirectory() << "." << '\n';
+        }
+        void exportUser()
+        {
+            auto format = exportFormatUtility();
+            string fileName = getInput("File name: ");
+
+            auto summary = manager->getStatementExporter().exportUserTransactions(authenticatedUser.first, format, fileName);
+            output << "Exported " << summary.getDescription() << " to " << fileName << " in " << OutputDirectory::getDirectory() << "." << '\n';
+        }
+        // dates are read as UTC midnight, like the dates stored with transactions
+        time_point<system_clock> dateUtility(const string &prompt)
+        {
+            while (true)
+            {
+                string date = getInput(prompt);
+                time_point<system_clock> result;
+                if (Validator::isDate(date) && TimestampCodec::parse(date, result))
+                    return result;
+                rejectInput("Please enter a date as YYYY-MM-DD.");
+            }
+        }
+        void viewVolume()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may view the transaction volume!"));
+            auto from = dateUtility("From (YYYY-MM-DD): ");
+            auto to = dateUtility("To (YYYY-MM-DD, exclusive): ");
+            auto totals = manager->getTransactionEntity().getTotalsByCurrency(from, to);
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<10} {:>12} {:>20}\n", "Currency", "count", "amount");
+            for (const auto &currency : totals)
+                rows.write("{:<10} {:>12} {:>20.2f}\n", currency.first, currency.second.getCount(), currency.second.getSum());
+        }
+        void viewTopBalances()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may view the largest balances!"));
+            string currencyCode = getInput("Currency: ");
+            string countString = getInput("Number of accounts: ");
+            if (countString.empty() || !all_of(countString.begin(), countString.end(), ::isdigit) || countString.size() > 6)
+                throw(ValidationException("The number of accounts must be a positive number!"));
+
+            auto accounts = manager->getAccountEntity().getTopAccounts(currencyCode, stoul(countString));
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:>6} {:<30} {:<30} {:>20}\n", "Rank", "IBAN", "Holder", "balance (" + currencyCode + ")");
+            size_t rank = 0;
+            for (const auto &account : accounts)
+                rows.write("{:>6} {:<30} {:<30} {:>20.2f}\n", ++rank, account.second.getIBAN(), account.second.getFullName(), account.second.getAmount());
+        }
+        void viewBalanceRank()
+        {
+            string IBAN = getInput("IBAN: ");
+            auto account = manager->getAccountEntity().getAccountFromIBAN(IBAN);
+            if (!isAdministrator())
+            {
+                auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+                if (accounts.find(account.first) == accounts.end())
+                    throw(InvalidBusinessLogicException("You may only view the rank of your own account!"));
+            }
+            auto rank = manager->getAccountEntity().getAccountRank(account.first);
+            output << "Account " << IBAN << " has the " << rank.first << " largest balance of the " << rank.second << " "
+                   << account.second.getCurrency().getCode() << " accounts." << '\n';
+        }
+        void viewAnalytics()
+        {
+            string IBAN = getInput("IBAN: ");
+            auto account = manager->getAccountEntity().getAccountFromIBAN(IBAN);
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+            if (accounts.find(account.first) == accounts.end())
+                throw(InvalidBusinessLogicException("You may only view analytics of your own account!"));
+
+            auto totals = manager->getTransactionEntity().getMonthlyTotals(account.first);
+            const auto &currency = account.second.getCurrency().getCode();
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<8} {:>16} {:>8} {:>16} {:>8} {:>16}\n", "Month", "In (" + currency + ")", "count", "Out (" + currency + ")", "count", "Net");
+            for (const auto &month : totals)
+                rows.write("{:<8} {:>16.2f} {:>8} {:>16.2f} {:>8} {:>16.2f}\n", month.getMonth(), month.getInbound(), month.getInboundCount(),
+                           month.getOutbound(), month.getOutboundCount(), month.getNet());
+        }
+        void viewPortfolio()
+        {
+            string targetCode = getInput("Currency: ");
+            auto &exchangeEntity = manager->getExchangeEntity();
+            auto &currencyEntity = manager->getCurrencyEntity();
+            auto accounts = manager->getAccountEntity().getUserAccounts(authenticatedUser.first);
+            vector<double> amounts;
+            vector<long long> currencyIds;
+            for (const auto &account : accounts)
+            {
+                amounts.emplace_back(account.second.getAmount());
+                currencyIds.emplace_back(currencyEntity.getCurrencyIdFromCode(account.second.getCurrency().getCode()));
+            }
+            auto converted = exchangeEntity.convertAmounts(amounts, currencyIds, targetCode);
+
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<30} {:>20} {:>20}\n", "IBAN", "balance", targetCode);
+            double total = 0;
+            size_t index = 0;
+            for (const auto &account : accounts)
+            {
+                rows.write("{:<30} {:>16.2f} {:<3} {:>20.2f}\n", account.second.getIBAN(), account.second.getAmount(), account.second.getCurrency().getCode(), converted[index]);
+                total += converted[index++];
+            }
+            rows.write("{:<30} {:>20} {:>20.2f}\n", "Total", "", total);
+
+            // the administrator also sees the holdings of the whole bank
+            if (isAdministrator())
+            {
+                auto balances = manager->getAccountEntity().getBalanceColumns();
+                auto holdings = exchangeEntity.convertAmounts(balances.first, balances.second, targetCode);
+                rows.write("{:<30} {:>20} {:>20.2f}\n", "Bank holdings (" + to_string(holdings.size()) + " accounts)", "", accumulate(holdings.begin(), holdings.end(), 0.0));
+            }
+        }
+        void reconcileBalances()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may reconcile balances!"));
+
+            auto report = manager->getBalanceReconciler().reconcile();
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("Checked {} accounts with {} workers in {} ms, {} discrepancies found.\n", report.getAccounts(), report.getWorkers(),
+                       duration_cast<milliseconds>(report.getElapsed()).count(), report.getDiscrepancies().size());
+            if (report.getDiscrepancies().empty())
+                return;
+            rows.write("{:<34} {:>16} {:>16} {:>16}\n", "IBAN", "recorded", "expected", "difference");
+            for (const auto &discrepancy : report.getDiscrepancies())
+                rows.write("{:<34} {:>16.2f} {:>16.2f} {:>16.2f}\n", discrepancy.getIBAN(), discrepancy.getRecorded(), discrepancy.getExpected(), discrepancy.getDifference());
+        }
+        void viewPartitions()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may manage partitions!"));
+            auto partitions = manager->getTransactionEntity().getPartitions();
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<28} {:>12}  {}\n", "Partition", "rows (est.)", "bounds");
+            for (const auto &partition : partitions)
+                rows.write("{:<28} {:>12}  {}\n", partition.getName(), partition.getEstimatedRows(), partition.getBounds());
+        }
+        void detachPartition()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may manage partitions!"));
+            string month;
+            while (true)
+            {
+                month = getInput("Month (YYYY-MM): ");
+                if (Validator::isMonth(month))
+                    break;
+                rejectInput("Please enter a month as YYYY-MM.");
+            }
+            auto partitionName = manager->getTransactionEntity().detachPartition(month);
+            output << "Partition " << partitionName << " detached, its transactions were folded into the opening balances." << '\n';
+        }
+        void archiveTransactions()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may archive transactions!"));
+            auto cutoff = dateUtility("Cutoff (YYYY-MM-DD): ");
+            auto archived = manager->getTransactionEntity().archiveTransactions(cutoff);
+            if (archived.first == 0)
+            {
+                output << "No transactions were made before the cutoff." << '\n';
+                return;
+            }
+            output << archived.first << " transactions archived";
+            if (!archived.second.empty())
+            {
+                auto bytes = filesystem::file_size(archived.second);
+                output << " to " << archived.second << " (" << bytes << " bytes, " << std::format("{:.1f}", static_cast<double>(bytes) / archived.first)
+                       << " bytes per transaction)";
+            }
+            output << ", and folded into the opening balances." << '\n';
+        }
+        void viewArchive()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may view the archive!"));
+            const auto &segments = manager->getTransactionEntity().getArchiveSegments();
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<40} {:>10} {:>12}  {}\n", "Segment", "rows", "bytes", "dates");
+            for (const auto &segment : segments)
+                rows.write("{:<40} {:>10} {:>12}  {:%F} - {:%F}\n", segment.getPath(), segment.getRows(), segment.getSize(),
+                           sys_seconds(seconds(segment.getFirstTimestamp())), sys_seconds(seconds(segment.getLastTimestamp())));
+        }
+        // the statistics are of every session, so only the administrator may see them
+        void stats()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may view statistics!"));
+            auto &registry = MetricsRegistry::getInstance();
+            auto counters = registry.getCounterValues();
+            auto counterValue = [&counters](const string &name)
+            {
+                auto counter = counters.find(name);
+                return counter == counters.end() ? 0 : counter->second;
+            };
+            auto toMicroseconds = [](nanoseconds value)
+            { return duration<double, micro>(value).count(); };
+
+            OutputBuffer rows(output, outputBuffer);
+            rows.write("{:<36} {:>10} {:>12} {:>12} {:>12} {:>12}\n", "Latency (us)", "count", "p50", "p99", "p999", "max");
+            for (const auto &histogram : registry.getHistograms())
+                if (histogram.second->getCount() > 0)
+                    rows.write("{:<36} {:>10} {:>12.1f} {:>12.1f} {:>12.1f} {:>12.1f}\n", histogram.first, histogram.second->getCount(),
+                               toMicroseconds(histogram.second->getPercentile(50)), toMicroseconds(histogram.second->getPercentile(99)),
+                               toMicroseconds(histogram.second->getPercentile(99.9)), toMicroseconds(histogram.second->getMaximum()));
+
+            // a hit is a lookup by id served from memory, bypasses are lookups that go to the database
+            rows.write("\n{:<36} {:>10} {:>12} {:>12} {:>12}\n", "Cache", "hits", "misses", "bypasses", "hit ratio");
+            for (const auto &counter : counters)
+                if (counter.first.starts_with("cache.") && counter.first.ends_with(".hits"))
+                {
+                    auto prefix = counter.first.substr(0, counter.first.length() - string(".hits").length());
+                    auto misses = counterValue(prefix + ".misses");
+                    auto bypasses = counterValue(prefix + ".bypasses");
+                    auto lookups = counter.second + misses + bypasses;
+                    rows.write("{:<36} {:>10} {:>12} {:>12} {:>11.1f}%\n", prefix.substr(string("cache.").length()), counter.second, misses, bypasses,
+                               lookups == 0 ? 0.0 : 100.0 * counter.second / lookups);
+                }
+
+            rows.write("\n{:<36} {:>10} {:>12} {:>12}\n", "Command", "count", "trips/cmd", "rows/cmd");
+            for (const auto &counter : counters)
+                if (counter.first.starts_with("command.") && counter.first.ends_with(".invocations") && counter.second > 0)
+                {
+                    auto prefix = counter.first.substr(0, counter.first.length() - string(".invocations").length());
+                    rows.write("{:<36} {:>10} {:>12.1f} {:>12.1f}\n", prefix.substr(string("command.").length()), counter.second,
+                               static_cast<double>(counterValue(prefix + ".roundTrips")) / counter.second,
+                               static_cast<double>(counterValue(prefix + ".decodedRows")) / counter.second);
+                }
+        }
+        void statsDump()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may view statistics!"));
+            string fileName = getInput("File name: ");
+            auto filePath = OutputDirectory::resolve(fileName);
+            ofstream file(filePath, ios_base::out | ios_base::trunc);
+            if (!file.is_open())
+                throw(ValidationException("Could not open statistics file " + filePath + "!"));
+            MetricsRegistry::getInstance().writeJSON(file);
+            output << "Statistics written to " << filePath << "." << '\n';
+        }
+        // the tracer is shared by every session, so only the administrator may control it
+        void traceStart()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may control tracing!"));
+            Tracer::getInstance().clear();
+            Tracer::setEnabled(true);
+            output << "Tracing started." << '\n';
+        }
+        void traceStop()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may control tracing!"));
+            Tracer::setEnabled(false);
+            output << "Tracing stopped." << '\n';
+        }
+        void traceDump()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may control tracing!"));
+            string fileName = getInput("File name: ");
+            auto filePath = OutputDirectory::resolve(fileName);
+            ofstream file(filePath, ios_base::out | ios_base::trunc);
+            if (!file.is_open())
+                throw(ValidationException("Could not open trace file " + filePath + "!"));
+            auto events = Tracer::getInstance().writeChromeTrace(file);
+            output << events << " trace events written to " << filePath << "." << '\n';
+        }
+        void viewRate()
+        {
+            string sourceCode = getInput("Source currency: ");
+            string destinationCode = getInput("Destination currency: ");
+            auto at = dateUtility("Date (YYYY-MM-DD): ");
+            auto rate = manager->getExchangeEntity().getRate(sourceCode, destinationCode, at);
+            output << sourceCode << " -> " << destinationCode << " at " << rate << '\n';
+        }
+        void ingestRates()
+        {
+            if (!isAdministrator())
+                throw(InvalidBusinessLogicException("Only the administrator may ingest exchange rates!"));
+            string filePath = getInput("File path: ");
+            ifstream file(filePath);
+            if (!file.is_open())
+                throw(ValidationException("Could not open rate feed " + filePath + "!"));
+            auto inserted = manager->getExchangeEntity().ingestRates(file);
+            output << inserted << " new exchange rates ingested from " << filePath << "." << '\n';
         }
         void viewExchange()
         {
-            auto exchanges = manager.getExchangeEntity().getExchangeDisplayData();
+            auto exchanges = manager->getExchangeEntity().getExchangeDisplayData();
             for (const auto &exchange : exchanges)
-                cout << get<0>(exchange) << " -> " << get<1>(exchange) << " at " << get<2>(exchange) << endl;
+                output << get<0>(exchange) << " -> " << get<1>(exchange) << " at " << get<2>(exchange) << '\n';
         }
 
     public:
-        CLI(string databaseConnectionString, string initializationFilePath) : manager{shared_ptr<pqxx::connection>(new pqxx::connection(databaseConnectionString)), initializationFilePath}
+        CLI(string databaseConnectionString, string initializationFilePath, istream &input = cin, ostream &output = cout, bool interactive = true)
+            : CLI(make_shared<DatabaseManager>(shared_ptr<pqxx::connection>(new pqxx::connection(databaseConnectionString)), initializationFilePath), input, output, interactive) {}
+        // used for sessions sharing a database manager (i.e. server connections)
+        CLI(shared_ptr<DatabaseManager> manager, istream &input, ostream &output, bool interactive)
+            : manager(manager), input(input), output(output), interactive(interactive)
         {
             authenticatedUser.first = -1;
             commandMapping.insert(make_pair(Command("clear", "clear terminal", false), [this]()
@@ -405,50 +812,174 @@ namespace interface
                                             { this->addTransaction(); }));
             commandMapping.insert(make_pair(Command("view-transactions", "view all transactions from an account", true), [this]()
                                             { this->viewTransactions(); }));
+            commandMapping.insert(make_pair(Command("view-history", "view the transactions of an account over a date range", true), [this]()
+                                            { this->viewHistory(); }));
+            commandMapping.insert(make_pair(Command("view-analytics", "view monthly totals of an account", true), [this]()
+                                            { this->viewAnalytics(); }));
+            commandMapping.insert(make_pair(Command("view-top-balances", "view the accounts with the largest balances in a currency", true), [this]()
+                                            { this->viewTopBalances(); }));
+            commandMapping.insert(make_pair(Command("view-balance-rank", "view the rank of an account by balance", true), [this]()
+                                            { this->viewBalanceRank(); }));
+            commandMapping.insert(make_pair(Command("view-portfolio", "view the value of your accounts in a currency", true), [this]()
+                                            { this->viewPortfolio(); }));
+            commandMapping.insert(make_pair(Command("view-volume", "view transaction volume by currency over a date range (administrator only)", true), [this]()
+                                            { this->viewVolume(); }));
+            commandMapping.insert(make_pair(Command("export-account", "export all transactions from an account to a file", true), [this]()
+                                            { this->exportAccount(); }));
+            commandMapping.insert(make_pair(Command("export-user", "export all transactions from your accounts to a file", true), [this]()
+                                            { this->exportUser(); }));
+            commandMapping.insert(make_pair(Command("reconcile-balances", "check account balances against their transactions (administrator only)", true), [this]()
+                                            { this->reconcileBalances(); }));
+            commandMapping.insert(make_pair(Command("view-partitions", "list the monthly transaction partitions (administrator only)", true), [this]()
+                                            { this->viewPartitions(); }));
+            commandMapping.insert(make_pair(Command("detach-partition", "detach the transactions of a past month for archiving (administrator only)", true), [this]()
+                                            { this->detachPartition(); }));
+            commandMapping.insert(make_pair(Command("archive-transactions", "move the transactions made before a date to the archive (administrator only)", true), [this]()
+                                            { this->archiveTransactions(); }));
+            commandMapping.insert(make_pair(Command("view-archive", "list the transaction archive segments (administrator only)", true), [this]()
+                                            { this->viewArchive(); }));
+            commandMapping.insert(make_pair(Command("stats", "view latency, cache and database statistics", true), [this]()
+                                            { this->stats(); }));
+            commandMapping.insert(make_pair(Command("stats-dump", "write statistics to a JSON file", true), [this]()
+                                            { this->statsDump(); }));
+            commandMapping.insert(make_pair(Command("trace-start", "start recording trace spans", true), [this]()
+                                            { this->traceStart(); }));
+            commandMapping.insert(make_pair(Command("trace-stop", "stop recording trace spans", true), [this]()
+                                            { this->traceStop(); }));
+            commandMapping.insert(make_pair(Command("trace-dump", "write recorded trace spans to a Chrome trace file", true), [this]()
+                                            { this->traceDump(); }));
             commandMapping.insert(make_pair(Command("view-exchange", "view current exchange rates", false), [this]()
                                             { this->viewExchange(); }));
+            commandMapping.insert(make_pair(Command("view-rate", "view the exchange rate of a currency pair on a date", false), [this]()
+                                            { this->viewRate(); }));
+            commandMapping.insert(make_pair(Command("ingest-rates", "load an exchange rate feed from a file (administrator only)", true), [this]()
+                                            { this->ingestRates(); }));
         }
         ~CLI() {}
 
+        bool getIsRunning() const { return isRunning; }
+        void setIsRunning(bool running) { isRunning = running; }
+
+        static string formatStatus(long long lineNumber, const string &name, CommandStatus status, const string &message)
+        {
+            string result = "@status\t" + to_string(lineNumber) + '\t' + commandStatusToString(status) + '\t' + name;
+            if (!message.empty())
+                result += '\t' + message;
+            result += '\n';
+            return result;
+        }
+
+        CommandStatus executeCommand(const string &name, string &message)
+        {
+            auto mapping = commandMapping.find(Command(name, "", false));
+            if (mapping == commandMapping.end())
+            {
+                message = "Command not found!";
+                return CommandStatus::NotFound;
+            }
+            if (authenticatedUser.first == -1 && mapping->first.getAuthenticationRequired())
+            {
+                message = "You must be authenticated to use this functionality!";
+                return CommandStatus::Unauthenticated;
+            }
+
+            ReadSession::Scope readScope(readSession);
+            auto &registry = MetricsRegistry::getInstance();
+            auto roundTrips = ThreadCounters::roundTrips;
+            auto decodedRows = ThreadCounters::decodedRows;
+
+            if (interactive)
+                output << '\n';
+            CommandStatus status = CommandStatus::Succeeded;
+            {
+                ScopedTimer timer(registry.getHistogram("command." + name));
+                TraceSpan span("command", name);
+                try
+                {
+                    mapping->second();
+                }
+                catch (logic_error const &exception)
+                {
+                    message = exception.what();
+                    status = CommandStatus::Failed;
+                    if (interactive)
+                        output << message << '\n';
+                }
+            }
+            if (interactive)
+                output << '\n';
+
+            registry.getCounter("command." + name + ".invocations").add();
+            registry.getCounter("command." + name + ".roundTrips").add(ThreadCounters::roundTrips - roundTrips);
+            registry.getCounter("command." + name + ".decodedRows").add(ThreadCounters::decodedRows - decodedRows);
+            return status;
+        }
+
         void start()
         {
             isRunning = true;
 
             clearUtility();
-            cout << "Welcome to Useless Bank! You can view the available commands by typing 'help' below." << endl;
-            cout << endl;
+            output << "Welcome to Useless Bank! You can view the available commands by typing 'help' below." << '\n';
+            output << '\n';
 
             while (isRunning)
             {
-                string input;
-                input = getInput("> ");
-
-                bool commandFound = false;
-                for (const auto &mapping : commandMapping)
-                    if (input == mapping.first.getName())
-                    {
-                        if (authenticatedUser.first == -1 && mapping.first.getAuthenticationRequired())
-                        {
-                            cout << "You must be authenticated to use this functionality!" << endl;
-                            commandFound = true;
-                            break;
-                        }
-                        cout << endl;
-                        try
-                        {
-                            mapping.second();
-                        }
-                        catch (logic_error const &exception)
-                        {
-                            cout << exception.what() << endl;
-                        }
-                        cout << endl;
-                        commandFound = true;
-                        break;
-                    }
-                if (!commandFound)
-                    cout << "Command not found!" << endl;
+                string name = getInput("> ");
+                string message;
+                auto status = executeCommand(name, message);
+                if (status == CommandStatus::NotFound || status == CommandStatus::Unauthenticated)
+                    output << message << '\n';
             }
         }
+        // executes a single script line, blank lines and comments have no status
+        optional<CommandStatus> executeLine(const string &line, string &name, string &message)
+        {
+            pendingInput.clear();
+            istringstream tokens(line);
+            for (string token; tokens >> token;)
+                pendingInput.emplace_back(token);
+            if (pendingInput.empty() || pendingInput.front().starts_with('#'))
+                return nullopt;
+
+            name = pendingInput.front();
+            pendingInput.pop_front();
+            try
+            {
+                return executeCommand(name, message);
+            }
+            catch (std::exception const &exception)
+            {
+                message = exception.what();
+                return CommandStatus::Failed;
+            }
+        }
+        // runs one command per line, with its arguments as whitespace separated tokens
+        // (i.e. "login admin@admin.com password"), and reports a status line for each of them
+        int runBatch()
+        {
+            isRunning = true;
+            long long lineNumber = 0, succeeded = 0, failed = 0;
+            auto batchStart = steady_clock::now();
+
+            for (string line; isRunning && getline(input, line);)
+            {
+                lineNumber++;
+                string name, message;
+                auto status = executeLine(line, name, message);
+                if (!status.has_value())
+                    continue;
+                if (status == CommandStatus::Succeeded)
+                    succeeded++;
+                else
+                    failed++;
+                output << formatStatus(lineNumber, name, *status, message);
+            }
+
+            auto elapsed = duration_cast<milliseconds>(steady_clock::now() - batchStart);
+            output << "@summary\t" << succeeded + failed << '\t' << succeeded << '\t' << failed << '\t' << elapsed.count() << "ms" << '\n';
+            output.flush();
+            return failed == 0 ? 0 : 1;
+        }
     };
 };
\ No newline at end of file
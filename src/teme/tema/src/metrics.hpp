@@ -0,0 +1,226 @@
+#include <map>
+#include <bit>
+#include <mutex>
+#include <cmath>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <format>
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace metrics
+{
+    // log-linear histogram of nanosecond latencies, every bucket is within 1/16 of its values,
+    // recording is lock-free so it may be used from any thread
+    class LatencyHistogram
+    {
+    private:
+        inline static const int subBucketBits = 4;
+        inline static const uint64_t subBucketCount = 1 << subBucketBits;
+        inline static const size_t bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+        array<atomic<uint64_t>, bucketCount> buckets{};
+        atomic<uint64_t> count = 0;
+        atomic<uint64_t> sum = 0;
+        atomic<uint64_t> maximum = 0;
+
+        static size_t getBucketIndex(uint64_t value)
+        {
+            if (value < subBucketCount)
+                return value;
+            int shift = bit_width(value) - 1 - subBucketBits;
+            uint64_t mantissa = (value >> shift) & (subBucketCount - 1);
+            return (shift + 1) * subBucketCount + mantissa;
+        }
+        static uint64_t getBucketUpperBound(size_t index)
+        {
+            if (index < subBucketCount)
+                return index;
+            uint64_t shift = index / subBucketCount - 1;
+            uint64_t mantissa = index % subBucketCount;
+            return ((subBucketCount + mantissa + 1) << shift) - 1;
+        }
+
+    public:
+        LatencyHistogram() {}
+        LatencyHistogram(const LatencyHistogram &) = delete;
+        ~LatencyHistogram() {}
+
+        void record(nanoseconds latency)
+        {
+            uint64_t value = latency.count() < 0 ? 0 : latency.count();
+            buckets[getBucketIndex(value)].fetch_add(1, memory_order_relaxed);
+            count.fetch_add(1, memory_order_relaxed);
+            sum.fetch_add(value, memory_order_relaxed);
+            uint64_t currentMaximum = maximum.load(memory_order_relaxed);
+            while (value > currentMaximum && !maximum.compare_exchange_weak(currentMaximum, value, memory_order_relaxed))
+                ;
+        }
+
+        uint64_t getCount() const { return count.load(memory_order_relaxed); }
+        nanoseconds getMean() const
+        {
+            auto currentCount = getCount();
+            return nanoseconds(currentCount == 0 ? 0 : sum.load(memory_order_relaxed) / currentCount);
+        }
+        nanoseconds getMaximum() const { return nanoseconds(maximum.load(memory_order_relaxed)); }
+        nanoseconds getPercentile(double percentile) const
+        {
+            auto currentCount = getCount();
+            if (currentCount == 0)
+                return nanoseconds(0);
+            // nearest rank: the smallest sample with at least percentile% of the samples at or below it
+            auto target = static_cast<uint64_t>(ceil(percentile / 100.0 * currentCount));
+            target = clamp<uint64_t>(target, 1, currentCount);
+            uint64_t cumulative = 0;
+            for (size_t index = 0; index < bucketCount; index++)
+            {
+                cumulative += buckets[index].load(memory_order_relaxed);
+                if (cumulative >= target)
+                    return nanoseconds(min(getBucketUpperBound(index), maximum.load(memory_order_relaxed)));
+            }
+            return getMaximum();
+        }
+
+        void reset()
+        {
+            for (auto &bucket : buckets)
+                bucket.store(0, memory_order_relaxed);
+            count = 0;
+            sum = 0;
+            maximum = 0;
+        }
+    };
+
+    class Counter
+    {
+    private:
+        atomic<long long> value = 0;
+
+    public:
+        Counter() {}
+        Counter(const Counter &) = delete;
+        ~Counter() {}
+
+        void add(long long amount = 1) { value.fetch_add(amount, memory_order_relaxed); }
+        long long getValue() const { return value.load(memory_order_relaxed); }
+        void reset() { value = 0; }
+    };
+
+    // work done by the current thread, used to attribute round trips and rows to commands
+    class ThreadCounters
+    {
+    public:
+        inline static thread_local long long roundTrips = 0;
+        inline static thread_local long long decodedRows = 0;
+    };
+
+    class MetricsRegistry
+    {
+    private:
+        mutex metricsMutex;
+        map<string, unique_ptr<LatencyHistogram>> histograms;
+        map<string, unique_ptr<Counter>> counters;
+
+        MetricsRegistry() {}
+
+    public:
+        MetricsRegistry(const MetricsRegistry &) = delete;
+        ~MetricsRegistry() {}
+
+        static MetricsRegistry &getInstance()
+        {
+            static MetricsRegistry instance;
+            return instance;
+        }
+
+        // histograms are never removed, so the returned reference may be kept around
+        LatencyHistogram &getHistogram(const string &name)
+        {
+            lock_guard<mutex> lock(metricsMutex);
+            auto &histogram = histograms[name];
+            if (!histogram)
+                histogram = make_unique<LatencyHistogram>();
+            return *histogram;
+        }
+        map<string, const LatencyHistogram *> getHistograms()
+        {
+            lock_guard<mutex> lock(metricsMutex);
+            map<string, const LatencyHistogram *> result;
+            for (const auto &histogram : histograms)
+                result.emplace(histogram.first, histogram.second.get());
+            return result;
+        }
+        Counter &getCounter(const string &name)
+        {
+            lock_guard<mutex> lock(metricsMutex);
+            auto &counter = counters[name];
+            if (!counter)
+                counter = make_unique<Counter>();
+            return *counter;
+        }
+        map<string, long long> getCounterValues()
+        {
+            lock_guard<mutex> lock(metricsMutex);
+            map<string, long long> result;
+            for (const auto &counter : counters)
+                result.emplace(counter.first, counter.second->getValue());
+            return result;
+        }
+        void reset()
+        {
+            lock_guard<mutex> lock(metricsMutex);
+            for (auto &histogram : histograms)
+                histogram.second->reset();
+            for (auto &counter : counters)
+                counter.second->reset();
+        }
+
+        // metric names are made of identifiers, table names and command names, none of which need escaping
+        void writeJSON(ostream &out)
+        {
+            auto iterator = ostreambuf_iterator<char>(out);
+            format_to(iterator, "{{\n  \"histograms\": {{");
+            bool first = true;
+            for (const auto &histogram : getHistograms())
+            {
+                format_to(iterator, "{}\n    \"{}\": {{\"count\": {}, \"mean_us\": {:.3f}, \"p50_us\": {:.3f}, \"p99_us\": {:.3f}, \"p999_us\": {:.3f}, \"max_us\": {:.3f}}}",
+                          first ? "" : ",", histogram.first, histogram.second->getCount(),
+                          duration<double, micro>(histogram.second->getMean()).count(),
+                          duration<double, micro>(histogram.second->getPercentile(50)).count(),
+                          duration<double, micro>(histogram.second->getPercentile(99)).count(),
+                          duration<double, micro>(histogram.second->getPercentile(99.9)).count(),
+                          duration<double, micro>(histogram.second->getMaximum()).count());
+                first = false;
+            }
+            format_to(iterator, "\n  }},\n  \"counters\": {{");
+            first = true;
+            for (const auto &counter : getCounterValues())
+            {
+                format_to(iterator, "{}\n    \"{}\": {}", first ? "" : ",", counter.first, counter.second);
+                first = false;
+            }
+            format_to(iterator, "\n  }}\n}}\n");
+        }
+    };
+
+    class ScopedTimer
+    {
+    private:
+        LatencyHistogram &histogram;
+        time_point<steady_clock> start;
+
+    public:
+        ScopedTimer(LatencyHistogram &histogram) : histogram(histogram), start(steady_clock::now()) {}
+        ScopedTimer(const ScopedTimer &) = delete;
+        ~ScopedTimer() { histogram.record(steady_clock::now() - start); }
+    };
+};
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <format>
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace exception;
+using namespace std::chrono;
+
+namespace database
+{
+    class TransactionPartition
+    {
+    private:
+        string name;
+        string bounds;
+        long long estimatedRows;
+
+    public:
+        TransactionPartition(string name, string bounds, long long estimatedRows) : name(name), bounds(bounds), estimatedRows(estimatedRows) {}
+        ~TransactionPartition() {}
+
+        const string &getName() const { return name; }
+        const string &getBounds() const { return bounds; }
+        long long getEstimatedRows() const { return estimatedRows; }
+    };
+
+    // the transactions table is partitioned by month on its date; partitions are created by the
+    // create_transaction_partition function of the initialization script, which is called the first time
+    // a month is written to. Rows outside of every partition end up in transactions_default, and are moved
+    // out of it when their month's partition is created
+    class TransactionPartitions
+    {
+    private:
+        weak_ptr<pqxx::connection> connection;
+        mutex monthsMutex;
+        // months known to have a partition, i.e. "2024-05"
+        set<string> months;
+
+        LatencyHistogram &createHistogram = MetricsRegistry::getInstance().getHistogram("partitions.create");
+
+        static string getPartitionName(const string &month) { return "transactions_" + month.substr(0, 4) + "_" + month.substr(5, 2); }
+
+    public:
+        TransactionPartitions(weak_ptr<pqxx::connection> connection) : connection(connection) {}
+        ~TransactionPartitions() {}
+
+        bool isAvailable() const { return !connection.expired(); }
+
+        void ensurePartition(time_point<system_clock> date)
+        {
+            auto month = std::format("{:%Y-%m}", floor<days>(date));
+            lock_guard<mutex> lock(monthsMutex);
+            if (months.contains(month))
+                return;
+
+            ScopedTimer timer(createHistogram);
+            TraceSpan span("partitions", "create");
+            Query query(connection, "SELECT create_transaction_partition(:day);");
+            query.setParameter<string>("day", month + "-01");
+            query.execute();
+            months.insert(month);
+        }
+
+        vector<TransactionPartition> getPartitions() const
+        {
+            Query query(connection, "SELECT c.relname, pg_get_expr(c.relpartbound, c.oid), greatest(c.reltuples, 0)::bigint FROM pg_inherits i "
+                                    "JOIN pg_class c ON c.oid = i.inhrelid WHERE i.inhparent = 'transactions'::regclass ORDER BY c.relname;");
+            vector<TransactionPartition> partitions;
+            for (const auto &row : query.execute())
+                partitions.emplace_back(row[0].as<string>(), row[1].as<string>(), row[2].as<long long>());
+            return partitions;
+        }
+
+        // the partition's transactions are folded into the opening balances of their accounts, so balances still
+        // add up without them, and into the daily summaries, if they were not yet, so analytics keep them too; the
+        // partition is left behind as a standalone table for archiving. Detaching locks the transactions table for
+        // a moment, so only past months may be detached
+        string detachPartition(const string &month)
+        {
+            if (month >= std::format("{:%Y-%m}", floor<days>(system_clock::now())))
+                throw(InvalidBusinessLogicException("Only partitions of past months may be detached!"));
+            string partitionName = getPartitionName(month);
+
+            Query attached(connection, "SELECT count(*) FROM pg_inherits WHERE inhparent = 'transactions'::regclass AND inhrelid = to_regclass(:name);");
+            attached.setParameter<string>("name", partitionName);
+            if (attached.execute()[0][0].as<long long>() == 0)
+                throw(EntryNotFoundException("There is no partition for " + month + "!"));
+
+            TraceSpan span("partitions", "detach");
+            Query query(connection, TransactionSummary::getRefreshQuery() +
+                                        "UPDATE accounts a SET opening = a.opening + c.change FROM ("
+                                        "SELECT account, sum(change) AS change FROM ("
+                                        "SELECT t.outbound AS account, -t.amount AS change FROM :outboundPartition t "
+                                        "UNION ALL SELECT t.inbound, t.amount * t.rate FROM :inboundPartition t"
+                                        ") changes GROUP BY account) c WHERE a.id = c.account; "
+                                        "ALTER TABLE transactions DETACH PARTITION :partition;");
+            query.setParameter<string>("outboundPartition", partitionName, false)
+                .setParameter<string>("inboundPartition", partitionName, false)
+                .setParameter<string>("partition", partitionName, false);
+            query.execute();
+
+            lock_guard<mutex> lock(monthsMutex);
+            months.erase(month);
+            info("event=partition.detached partition={}", partitionName);
+            return partitionName;
+        }
+    };
+};
\ No newline at end of file
@@ -1,3 +1,6 @@
+#include <tuple>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <type_traits>
 #include <pqxx/pqxx>
@@ -6,6 +9,9 @@
 using namespace std;
 using namespace pqxx;
 using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace std::chrono;
 
 namespace database
 {
@@ -15,7 +21,38 @@ namespace database
         weak_ptr<pqxx::connection> connection;
         string query;
 
+        // BEGIN, the statement itself and COMMIT
+        inline static const long long roundTripsPerQuery = 3;
+        inline static atomic<long long> slowQueryThreshold = duration_cast<microseconds>(milliseconds(100)).count();
+        inline static LatencyHistogram &prepareHistogram = MetricsRegistry::getInstance().getHistogram("query.prepare");
+        inline static LatencyHistogram &executeHistogram = MetricsRegistry::getInstance().getHistogram("query.execute");
+        inline static LatencyHistogram &commitHistogram = MetricsRegistry::getInstance().getHistogram("query.commit");
+        inline static LatencyHistogram &streamHistogram = MetricsRegistry::getInstance().getHistogram("query.stream");
+
+        // prepare covers acquiring the connection and opening the transaction
+        void logTimings(const char *operation, long long rows, nanoseconds prepare, nanoseconds execute, nanoseconds commit) const
+        {
+            auto total = duration_cast<microseconds>(prepare + execute + commit).count();
+            if (total >= slowQueryThreshold.load(memory_order_relaxed))
+                warn("event=query.slow operation={} rows={} total_us={} prepare_us={} execute_us={} commit_us={} query=\"{}\"", operation, rows, total,
+                     duration_cast<microseconds>(prepare).count(), duration_cast<microseconds>(execute).count(), duration_cast<microseconds>(commit).count(), query);
+            else
+                debug("event=query operation={} rows={} total_us={} query=\"{}\"", operation, rows, total, query);
+        }
+
+        // storage engines without a database (i.e. the in-memory one) have no connection
+        shared_ptr<pqxx::connection> getConnection() const
+        {
+            auto connectionPointer = connection.lock();
+            if (!connectionPointer)
+                throw(StorageOperationUnsupportedException("This operation needs a PostgreSQL database!"));
+            return connectionPointer;
+        }
+
     public:
+        static void setSlowQueryThreshold(milliseconds threshold) { slowQueryThreshold = duration_cast<microseconds>(threshold).count(); }
+        static milliseconds getSlowQueryThreshold() { return duration_cast<milliseconds>(microseconds(slowQueryThreshold.load())); }
+
         Query(weak_ptr<pqxx::connection> connection) : connection(connection) {}
         Query(weak_ptr<pqxx::connection> connection, string query) : connection(connection), query(query) {}
         ~Query() = default;
@@ -53,13 +90,73 @@ namespace database
             return *this;
         }
 
+        // streams the rows through a server side cursor (COPY), so only one row is held in memory,
+        // string_view columns are only valid during the callback
+        template <typename... ColumnTypes, typename Callback>
+        long long stream(Callback callback) const
+        {
+            TraceSpan span("query", "stream");
+            auto start = steady_clock::now();
+            ThreadCounters::roundTrips += roundTripsPerQuery;
+            shared_ptr<pqxx::connection> connectionPointer = getConnection();
+            work work(*connectionPointer.get());
+            auto stream = stream_from::query(work, query);
+            auto prepared = steady_clock::now();
+
+            long long count = 0;
+            tuple<ColumnTypes...> row;
+            while (stream >> row)
+            {
+                callback(row);
+                count++;
+            }
+            stream.complete();
+            auto executed = steady_clock::now();
+            work.commit();
+            auto committed = steady_clock::now();
+
+            prepareHistogram.record(prepared - start);
+            streamHistogram.record(executed - prepared);
+            commitHistogram.record(committed - executed);
+            logTimings("stream", count, prepared - start, executed - prepared, committed - executed);
+            return count;
+        }
+
         result execute() const
         {
-            shared_ptr<pqxx::connection> connectionPointer = connection.lock();
+            TraceSpan span("query", "execute");
+            auto start = steady_clock::now();
+            ThreadCounters::roundTrips += roundTripsPerQuery;
+            shared_ptr<pqxx::connection> connectionPointer = getConnection();
             work work(*connectionPointer.get());
+            auto prepared = steady_clock::now();
             result result = work.exec(query);
-            info("Executing query: " + query);
+            auto executed = steady_clock::now();
             work.commit();
+            auto committed = steady_clock::now();
+
+            prepareHistogram.record(prepared - start);
+            executeHistogram.record(executed - prepared);
+            commitHistogram.record(committed - executed);
+            logTimings("execute", result.size(), prepared - start, executed - prepared, committed - executed);
+            return result;
+        }
+        // a single statement without BEGIN and COMMIT, so a single round trip; only for reads, or statements that
+        // are atomic on their own
+        result executeAutocommit() const
+        {
+            TraceSpan span("query", "execute");
+            auto start = steady_clock::now();
+            ThreadCounters::roundTrips += 1;
+            shared_ptr<pqxx::connection> connectionPointer = getConnection();
+            nontransaction work(*connectionPointer.get());
+            auto prepared = steady_clock::now();
+            result result = work.exec(query);
+            auto executed = steady_clock::now();
+
+            prepareHistogram.record(prepared - start);
+            executeHistogram.record(executed - prepared);
+            logTimings("execute", result.size(), prepared - start, executed - prepared, nanoseconds(0));
             return result;
         }
     };
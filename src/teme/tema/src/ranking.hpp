@@ -0,0 +1,188 @@
+#include <map>
+#include <random>
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace std;
+
+namespace database
+{
+    // balances ordered from the largest down (ties by account id), kept in a treap whose nodes know the size
+    // of their subtree, so inserts, erases and ranks are logarithmic and the first n balances are found
+    // without walking the rest
+    class BalanceTree
+    {
+    private:
+        struct Node
+        {
+            double amount;
+            long long accountId;
+            uint32_t priority;
+            size_t size = 1;
+            unique_ptr<Node> left;
+            unique_ptr<Node> right;
+
+            Node(double amount, long long accountId, uint32_t priority) : amount(amount), accountId(accountId), priority(priority) {}
+        };
+
+        unique_ptr<Node> root;
+        mt19937 generator{random_device{}()};
+
+        static size_t getSize(const unique_ptr<Node> &node) { return node ? node->size : 0; }
+        static void updateSize(Node &node) { node.size = 1 + getSize(node.left) + getSize(node.right); }
+        static bool precedes(double amount, long long accountId, double otherAmount, long long otherAccountId)
+        {
+            return amount > otherAmount || (amount == otherAmount && accountId < otherAccountId);
+        }
+
+        // left gets the nodes preceding (amount, account id), right gets the rest
+        static void split(unique_ptr<Node> node, double amount, long long accountId, unique_ptr<Node> &left, unique_ptr<Node> &right)
+        {
+            if (!node)
+            {
+                left.reset();
+                right.reset();
+                return;
+            }
+            if (precedes(node->amount, node->accountId, amount, accountId))
+            {
+                split(move(node->right), amount, accountId, node->right, right);
+                updateSize(*node);
+                left = move(node);
+            }
+            else
+            {
+                split(move(node->left), amount, accountId, left, node->left);
+                updateSize(*node);
+                right = move(node);
+            }
+        }
+        // every node of left precedes every node of right
+        static unique_ptr<Node> merge(unique_ptr<Node> left, unique_ptr<Node> right)
+        {
+            if (!left)
+                return right;
+            if (!right)
+                return left;
+            if (left->priority > right->priority)
+            {
+                left->right = merge(move(left->right), move(right));
+                updateSize(*left);
+                return left;
+            }
+            right->left = merge(move(left), move(right->left));
+            updateSize(*right);
+            return right;
+        }
+
+    public:
+        BalanceTree() {}
+        ~BalanceTree() {}
+
+        size_t size() const { return getSize(root); }
+        void insert(double amount, long long accountId)
+        {
+            unique_ptr<Node> left, right;
+            split(move(root), amount, accountId, left, right);
+            root = merge(merge(move(left), make_unique<Node>(amount, accountId, generator())), move(right));
+        }
+        void erase(double amount, long long accountId)
+        {
+            unique_ptr<Node> left, middle, right;
+            split(move(root), amount, accountId, left, right);
+            // ids are whole numbers, so the next one splits off exactly the erased node
+            split(move(right), amount, accountId + 1, middle, right);
+            root = merge(move(left), move(right));
+        }
+        // the number of balances preceding the given one
+        size_t countPreceding(double amount, long long accountId) const
+        {
+            size_t count = 0;
+            for (const Node *node = root.get(); node != nullptr;)
+                if (precedes(node->amount, node->accountId, amount, accountId))
+                {
+                    count += getSize(node->left) + 1;
+                    node = node->right.get();
+                }
+                else
+                    node = node->left.get();
+            return count;
+        }
+        // the first count (account id, balance) pairs, largest first
+        vector<pair<long long, double>> getFirst(size_t count) const
+        {
+            vector<pair<long long, double>> result;
+            vector<const Node *> path;
+            for (const Node *node = root.get(); result.size() < count && (node != nullptr || !path.empty());)
+            {
+                if (node != nullptr)
+                {
+                    path.emplace_back(node);
+                    node = node->left.get();
+                    continue;
+                }
+                node = path.back();
+                path.pop_back();
+                result.emplace_back(node->accountId, node->amount);
+                node = node->right.get();
+            }
+            return result;
+        }
+    };
+
+    // the balances of every account, ranked within their currency; kept up to date by the account entity on
+    // every balance change, so the largest balances are read without sorting the accounts
+    class BalanceRanking
+    {
+    private:
+        map<string, BalanceTree> trees;
+        // currency and balance of every ranked account, to find its node again
+        unordered_map<long long, pair<string, double>> balances;
+
+    public:
+        BalanceRanking() {}
+        ~BalanceRanking() {}
+
+        size_t size() const { return balances.size(); }
+        void clear()
+        {
+            trees.clear();
+            balances.clear();
+        }
+        void set(long long accountId, const string &currency, double amount)
+        {
+            erase(accountId);
+            trees[currency].insert(amount, accountId);
+            balances.emplace(accountId, make_pair(currency, amount));
+        }
+        void erase(long long accountId)
+        {
+            auto balance = balances.find(accountId);
+            if (balance == balances.end())
+                return;
+            trees[balance->second.first].erase(balance->second.second, accountId);
+            balances.erase(balance);
+        }
+
+        vector<pair<long long, double>> getTop(const string &currency, size_t count) const
+        {
+            auto tree = trees.find(currency);
+            if (tree == trees.end())
+                return {};
+            return tree->second.getFirst(count);
+        }
+        // the account's 1 based rank among the accounts of its currency, and the number of those accounts;
+        // (0, 0) if the account is not ranked
+        pair<size_t, size_t> getRank(long long accountId) const
+        {
+            auto balance = balances.find(accountId);
+            if (balance == balances.end())
+                return make_pair(0, 0);
+            const auto &tree = trees.at(balance->second.first);
+            return make_pair(tree.countPreceding(balance->second.second, accountId) + 1, tree.size());
+        }
+    };
+};
\ No newline at end of file
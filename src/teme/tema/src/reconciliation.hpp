@@ -0,0 +1,214 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <format>
+#include <exception>
+#include <unordered_map>
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace std::chrono;
+
+namespace database
+{
+    // an account whose balance is not its opening balance plus its transactions
+    class BalanceDiscrepancy
+    {
+    private:
+        long long accountId;
+        string IBAN;
+        double recorded;
+        double expected;
+
+    public:
+        BalanceDiscrepancy(long long accountId, string IBAN, double recorded, double expected) : accountId(accountId), IBAN(IBAN), recorded(recorded), expected(expected) {}
+        ~BalanceDiscrepancy() {}
+
+        long long getAccountId() const { return accountId; }
+        const string &getIBAN() const { return IBAN; }
+        double getRecorded() const { return recorded; }
+        double getExpected() const { return expected; }
+        double getDifference() const { return recorded - expected; }
+    };
+
+    class ReconciliationReport
+    {
+    private:
+        long long accounts;
+        size_t workers;
+        vector<BalanceDiscrepancy> discrepancies;
+        nanoseconds elapsed;
+
+    public:
+        ReconciliationReport(long long accounts, size_t workers, vector<BalanceDiscrepancy> discrepancies, nanoseconds elapsed)
+            : accounts(accounts), workers(workers), discrepancies(move(discrepancies)), elapsed(elapsed) {}
+        ~ReconciliationReport() {}
+
+        long long getAccounts() const { return accounts; }
+        size_t getWorkers() const { return workers; }
+        const vector<BalanceDiscrepancy> &getDiscrepancies() const { return discrepancies; }
+        nanoseconds getElapsed() const { return elapsed; }
+    };
+
+    // recomputes every balance as the opening balance plus inbound transfers (converted at the rate recorded
+    // with them) minus outbound transfers, and compares it with the recorded one. On PostgreSQL the accounts are
+    // split into id ranges, which workers take in turn, each on its own connection; all of them read the
+    // snapshot exported by the coordinator, so the ranges agree with each other, and read only repeatable
+    // read transactions take no locks that would hold up transfers
+    class BalanceReconciler
+    {
+    private:
+        // amounts are stored as doubles, anything under a cent is rounding
+        inline static const double tolerance = 0.005;
+        // ranges per worker, so a worker that drew a busy range does not hold up the others
+        inline static const size_t rangesPerWorker = 8;
+        // every worker holds a connection, leave some for the online traffic
+        inline static const size_t maximumWorkers = 32;
+
+        shared_ptr<Storage> storage;
+
+        LatencyHistogram &runHistogram = MetricsRegistry::getInstance().getHistogram("reconciliation.run");
+        Counter &discrepancyCounter = MetricsRegistry::getInstance().getCounter("reconciliation.discrepancies");
+
+        // (id, iban, recorded, expected) of the discrepant accounts matching the filter
+        static string getDiscrepancyQuery(const string &accountFilter)
+        {
+            return std::format(
+                "WITH checked AS (SELECT id, iban, amount, opening FROM accounts WHERE {}), "
+                "inbound AS (SELECT t.inbound AS account, sum(t.amount * t.rate) AS total FROM transactions t JOIN checked c ON c.id = t.inbound GROUP BY t.inbound), "
+                "outbound AS (SELECT t.outbound AS account, sum(t.amount) AS total FROM transactions t JOIN checked c ON c.id = t.outbound GROUP BY t.outbound), "
+                "balances AS (SELECT c.id, c.iban, c.amount, c.opening + coalesce(i.total, 0) - coalesce(o.total, 0) AS expected "
+                "FROM checked c LEFT JOIN inbound i ON i.account = c.id LEFT JOIN outbound o ON o.account = c.id) "
+                "SELECT id, iban, amount, expected FROM balances WHERE abs(amount - expected) > {} ORDER BY id;",
+                accountFilter, tolerance);
+        }
+        static void collectDiscrepancies(const pqxx::result &result, vector<BalanceDiscrepancy> &discrepancies)
+        {
+            for (const auto &row : result)
+                discrepancies.emplace_back(row[0].as<long long>(), row[1].as<string>(), row[2].as<double>(), row[3].as<double>());
+        }
+
+        ReconciliationReport reconcileDatabase(const pqxx::connection &connection, size_t workers)
+        {
+            auto start = steady_clock::now();
+            string connectionString = connection.connection_string();
+
+            // the coordinator keeps its transaction open until every worker has imported the snapshot
+            pqxx::connection coordinatorConnection(connectionString);
+            vector<BalanceDiscrepancy> found;
+            long long accounts = 0;
+            {
+                pqxx::transaction<pqxx::isolation_level::repeatable_read, pqxx::write_policy::read_only> coordinator(coordinatorConnection);
+                auto snapshot = coordinator.exec("SELECT pg_export_snapshot();")[0][0].as<string>();
+                auto bounds = coordinator.exec("SELECT coalesce(min(id), 0), coalesce(max(id), -1), count(*) FROM accounts;")[0];
+                auto firstId = bounds[0].as<long long>();
+                auto lastId = bounds[1].as<long long>();
+                accounts = bounds[2].as<long long>();
+
+                auto ranges = static_cast<long long>(workers * rangesPerWorker);
+                auto rangeSize = max(1LL, (lastId - firstId + ranges) / ranges);
+                atomic<long long> nextRange = 0;
+                mutex foundMutex;
+                exception_ptr failure;
+
+                vector<thread> workerThreads;
+                for (size_t worker = 0; worker < workers; worker++)
+                    workerThreads.emplace_back([&]()
+                                               {
+                                                   try
+                                                   {
+                                                       pqxx::connection workerConnection(connectionString);
+                                                       pqxx::transaction<pqxx::isolation_level::repeatable_read, pqxx::write_policy::read_only> work(workerConnection);
+                                                       work.exec("SET TRANSACTION SNAPSHOT " + work.quote(snapshot) + ";");
+                                                       vector<BalanceDiscrepancy> workerFound;
+                                                       for (long long range; (range = nextRange++) < ranges;)
+                                                       {
+                                                           auto from = firstId + range * rangeSize;
+                                                           if (from > lastId)
+                                                               break;
+                                                           TraceSpan span("reconciliation", "range");
+                                                           collectDiscrepancies(work.exec(getDiscrepancyQuery(std::format("id >= {} AND id < {}", from, from + rangeSize))), workerFound);
+                                                       }
+                                                       work.commit();
+
+                                                       lock_guard<mutex> lock(foundMutex);
+                                                       found.insert(found.end(), workerFound.begin(), workerFound.end());
+                                                   }
+                                                   catch (std::exception const &exception)
+                                                   {
+                                                       error("Reconciliation worker failed: " + string(exception.what()));
+                                                       lock_guard<mutex> lock(foundMutex);
+                                                       if (!failure)
+                                                           failure = current_exception();
+                                                   } });
+                for (auto &workerThread : workerThreads)
+                    workerThread.join();
+                if (failure)
+                    rethrow_exception(failure);
+                coordinator.commit();
+            }
+
+            // a transfer writes its balances and its row in one transaction, so the snapshot never holds half of one
+            sort(found.begin(), found.end(), [](const BalanceDiscrepancy &first, const BalanceDiscrepancy &second)
+                 { return first.getAccountId() < second.getAccountId(); });
+            return ReconciliationReport(accounts, workers, move(found), steady_clock::now() - start);
+        }
+
+        // without a database the tables are scanned through the storage engine, in a single pass over the transactions
+        ReconciliationReport reconcileStorage()
+        {
+            auto start = steady_clock::now();
+            // iban, recorded and expected balance
+            unordered_map<long long, tuple<string, double, double>> balances;
+            storage->scan("accounts", [&balances](const Record &record)
+                          { balances.emplace(record.get<long long>(0), make_tuple(record.get<string>(3), record.get<double>(4), record.get<double>(7))); });
+            storage->scan("transactions", [&](const Record &record)
+                          {
+                              auto inbound = balances.find(record.get<long long>(1));
+                              auto outbound = balances.find(record.get<long long>(2));
+                              if (inbound == balances.end() || outbound == balances.end())
+                                  return;
+                              auto amount = record.get<double>(3);
+                              get<2>(outbound->second) -= amount;
+                              get<2>(inbound->second) += amount * record.get<double>(5); });
+
+            vector<BalanceDiscrepancy> discrepancies;
+            for (const auto &[id, balance] : balances)
+                if (abs(get<1>(balance) - get<2>(balance)) > tolerance)
+                    discrepancies.emplace_back(id, get<0>(balance), get<1>(balance), get<2>(balance));
+            sort(discrepancies.begin(), discrepancies.end(), [](const BalanceDiscrepancy &first, const BalanceDiscrepancy &second)
+                 { return first.getAccountId() < second.getAccountId(); });
+            return ReconciliationReport(balances.size(), 1, move(discrepancies), steady_clock::now() - start);
+        }
+
+    public:
+        BalanceReconciler(shared_ptr<Storage> storage) : storage(storage) {}
+        ~BalanceReconciler() {}
+
+        ReconciliationReport reconcile(size_t workers = thread::hardware_concurrency())
+        {
+            ScopedTimer timer(runHistogram);
+            TraceSpan span("reconciliation", "run");
+            workers = clamp<size_t>(workers, 1, maximumWorkers);
+            // the snapshots are taken on a replica when there is one
+            ReadSession::ReplicaScope replicaScope;
+            auto connection = storage->getReadConnection().lock();
+            auto report = connection ? reconcileDatabase(*connection, workers) : reconcileStorage();
+
+            discrepancyCounter.add(report.getDiscrepancies().size());
+            info("event=reconciliation accounts={} workers={} discrepancies={} elapsed_ms={}", report.getAccounts(), report.getWorkers(),
+                 report.getDiscrepancies().size(), duration_cast<milliseconds>(report.getElapsed()).count());
+            for (const auto &discrepancy : report.getDiscrepancies())
+                warn("event=reconciliation.discrepancy account={} iban={} recorded={} expected={}", discrepancy.getAccountId(), discrepancy.getIBAN(),
+                     discrepancy.getRecorded(), discrepancy.getExpected());
+            return report;
+        }
+    };
+};
\ No newline at end of file
@@ -0,0 +1,487 @@
+#include <map>
+#include <queue>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <sstream>
+#include <functional>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+using namespace std;
+using namespace spdlog;
+using namespace exception;
+using namespace interface;
+
+namespace server
+{
+    class WorkerPool
+    {
+    private:
+        vector<thread> workers;
+        queue<function<void()>> jobs;
+        mutex jobsMutex;
+        condition_variable jobsCondition;
+        bool stopping = false;
+
+        void work()
+        {
+            while (true)
+            {
+                function<void()> job;
+                {
+                    unique_lock<mutex> lock(jobsMutex);
+                    jobsCondition.wait(lock, [this]()
+                                       { return stopping || !jobs.empty(); });
+                    if (stopping && jobs.empty())
+                        return;
+                    job = move(jobs.front());
+                    jobs.pop();
+                }
+                job();
+            }
+        }
+
+    public:
+        WorkerPool(size_t size)
+        {
+            for (size_t index = 0; index < max<size_t>(size, 1); index++)
+                workers.emplace_back([this]()
+                                     { this->work(); });
+        }
+        ~WorkerPool() { stop(); }
+
+        // finishes the queued jobs and joins the workers, later calls do nothing
+        void stop()
+        {
+            {
+                lock_guard<mutex> lock(jobsMutex);
+                stopping = true;
+            }
+            jobsCondition.notify_all();
+            for (auto &worker : workers)
+                if (worker.joinable())
+                    worker.join();
+        }
+
+        void submit(function<void()> job)
+        {
+            {
+                lock_guard<mutex> lock(jobsMutex);
+                jobs.emplace(move(job));
+            }
+            jobsCondition.notify_one();
+        }
+    };
+
+    // state of a single client connection, each one has its own authenticated user
+    class Session
+    {
+    private:
+        int descriptor;
+        string readBuffer, writeBuffer;
+        deque<string> pendingLines;
+        bool busy = false;
+        bool closing = false;
+        bool exited = false;
+        long long requestCount = 0;
+
+        istringstream sessionInput;
+        ostringstream sessionOutput;
+        CLI cli;
+
+    public:
+        Session(int descriptor, shared_ptr<DatabaseManager> manager) : descriptor(descriptor), cli(manager, sessionInput, sessionOutput, false)
+        {
+            cli.setIsRunning(true);
+        }
+        ~Session() = default;
+
+        int getDescriptor() const { return descriptor; }
+        void setDescriptor(int newDescriptor) { descriptor = newDescriptor; }
+
+        string &getReadBuffer() { return readBuffer; }
+        string &getWriteBuffer() { return writeBuffer; }
+        deque<string> &getPendingLines() { return pendingLines; }
+
+        bool getBusy() const { return busy; }
+        void setBusy(bool newBusy) { busy = newBusy; }
+
+        bool getClosing() const { return closing; }
+        void setClosing(bool newClosing) { closing = newClosing; }
+
+        bool getExited() const { return exited; }
+
+        // runs on a worker thread, a session never has more than one request in flight
+        string execute(const string &line)
+        {
+            requestCount++;
+            string name, message;
+            auto status = cli.executeLine(line, name, message);
+            if (!status.has_value())
+                return "";
+
+            string response = sessionOutput.str();
+            sessionOutput.str("");
+            response += CLI::formatStatus(requestCount, name, *status, message);
+            // read by the event loop once the completion is collected
+            if (!cli.getIsRunning())
+                exited = true;
+            return response;
+        }
+    };
+
+#ifdef __linux__
+    // line protocol: each request line is a command followed by its arguments, as in batch mode,
+    // and each response ends with the "@status" line of that command
+    class Server
+    {
+    private:
+        inline static const size_t maximumLineLength = 64 * 1024;
+        inline static const int maximumEvents = 256;
+        // a session is not read while it has this many requests queued, or this much output its client has not read
+        // yet, so a client sending requests without reading the responses can not make the buffers grow without bound
+        inline static const size_t maximumPendingLines = 64;
+        inline static const size_t maximumWriteBuffer = 1024 * 1024;
+
+        shared_ptr<DatabaseManager> manager;
+        string address;
+
+        int listenDescriptor = -1;
+        int pollDescriptor = -1;
+        int wakeDescriptor = -1;
+        atomic<bool> isRunning = false;
+        map<int, shared_ptr<Session>> sessions;
+
+        // the database connection and the entity caches are not thread safe, so commands run one at a time on a
+        // single worker, while the event loop keeps serving the other connections
+        mutex completionsMutex;
+        vector<pair<shared_ptr<Session>, string>> completions;
+        // declared last, so that the workers are joined before anything they use is destroyed
+        WorkerPool workerPool;
+
+        static void setNonBlocking(int descriptor)
+        {
+            int flags = fcntl(descriptor, F_GETFL, 0);
+            if (flags == -1 || fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) == -1)
+                throw(ServerException("Could not make descriptor non-blocking: " + string(strerror(errno))));
+        }
+
+        int openListener()
+        {
+            int descriptor;
+            if (address.starts_with("unix:"))
+            {
+                string path = address.substr(5);
+                sockaddr_un socketAddress = {};
+                socketAddress.sun_family = AF_UNIX;
+                if (path.length() >= sizeof(socketAddress.sun_path))
+                    throw(ServerException("Unix socket path " + path + " is too long!"));
+                strncpy(socketAddress.sun_path, path.c_str(), sizeof(socketAddress.sun_path) - 1);
+                unlink(path.c_str());
+
+                descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (descriptor == -1 || bind(descriptor, reinterpret_cast<sockaddr *>(&socketAddress), sizeof(socketAddress)) == -1)
+                    throw(ServerException("Could not bind " + address + ": " + string(strerror(errno))));
+            }
+            else
+            {
+                string host = "127.0.0.1";
+                string port = address;
+                auto separator = address.rfind(':');
+                if (separator != string::npos)
+                {
+                    host = address.substr(0, separator);
+                    port = address.substr(separator + 1);
+                }
+                sockaddr_in socketAddress = {};
+                socketAddress.sin_family = AF_INET;
+                socketAddress.sin_port = htons(static_cast<uint16_t>(stoi(port)));
+                if (inet_pton(AF_INET, host.c_str(), &socketAddress.sin_addr) != 1)
+                    throw(ServerException("Invalid server host " + host + "!"));
+
+                descriptor = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                int enable = 1;
+                setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+                if (descriptor == -1 || bind(descriptor, reinterpret_cast<sockaddr *>(&socketAddress), sizeof(socketAddress)) == -1)
+                    throw(ServerException("Could not bind " + address + ": " + string(strerror(errno))));
+            }
+            if (listen(descriptor, SOMAXCONN) == -1)
+                throw(ServerException("Could not listen on " + address + ": " + string(strerror(errno))));
+            setNonBlocking(descriptor);
+            return descriptor;
+        }
+
+        void watch(int descriptor, uint32_t events, int operation = EPOLL_CTL_ADD)
+        {
+            epoll_event event = {};
+            event.events = events;
+            event.data.fd = descriptor;
+            if (epoll_ctl(pollDescriptor, operation, descriptor, &event) == -1)
+                throw(ServerException("Could not watch descriptor: " + string(strerror(errno))));
+        }
+
+        void acceptConnections()
+        {
+            while (true)
+            {
+                int descriptor = accept4(listenDescriptor, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (descriptor == -1)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        warn("Could not accept connection: " + string(strerror(errno)));
+                    return;
+                }
+                if (!address.starts_with("unix:"))
+                {
+                    int enable = 1;
+                    setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                }
+                sessions.emplace(descriptor, make_shared<Session>(descriptor, manager));
+                watch(descriptor, EPOLLIN);
+            }
+        }
+
+        void closeSession(shared_ptr<Session> session)
+        {
+            int descriptor = session->getDescriptor();
+            if (descriptor == -1)
+                return;
+            epoll_ctl(pollDescriptor, EPOLL_CTL_DEL, descriptor, nullptr);
+            close(descriptor);
+            session->setDescriptor(-1);
+            sessions.erase(descriptor);
+        }
+
+        void dispatch(shared_ptr<Session> session)
+        {
+            if (session->getBusy() || session->getPendingLines().empty())
+                return;
+            string line = move(session->getPendingLines().front());
+            session->getPendingLines().pop_front();
+            session->setBusy(true);
+
+            workerPool.submit([this, session, line]()
+                              {
+                                  string response = session->execute(line);
+                                  {
+                                      lock_guard<mutex> lock(completionsMutex);
+                                      completions.emplace_back(session, move(response));
+                                  }
+                                  uint64_t signal = 1;
+                                  (void)!write(wakeDescriptor, &signal, sizeof(signal)); });
+        }
+
+        static bool isSaturated(Session &session)
+        {
+            return session.getPendingLines().size() >= maximumPendingLines || session.getWriteBuffer().length() >= maximumWriteBuffer;
+        }
+        // moves the complete lines of the read buffer to the pending lines; false if the incomplete line left is
+        // already too long
+        static bool splitLines(Session &session)
+        {
+            auto &readBuffer = session.getReadBuffer();
+            size_t lineStart = 0;
+            for (auto lineEnd = readBuffer.find('\n'); lineEnd != string::npos; lineEnd = readBuffer.find('\n', lineStart))
+            {
+                string line = readBuffer.substr(lineStart, lineEnd - lineStart);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                session.getPendingLines().emplace_back(move(line));
+                lineStart = lineEnd + 1;
+            }
+            readBuffer.erase(0, lineStart);
+            return readBuffer.length() <= maximumLineLength;
+        }
+
+        void readSession(shared_ptr<Session> session)
+        {
+            char buffer[16 * 1024];
+            while (!isSaturated(*session))
+            {
+                auto count = recv(session->getDescriptor(), buffer, sizeof(buffer), 0);
+                if (count > 0)
+                {
+                    session->getReadBuffer().append(buffer, count);
+                    if (!splitLines(*session))
+                    {
+                        warn("Closing connection with a request line longer than " + to_string(maximumLineLength) + " bytes.");
+                        closeSession(session);
+                        return;
+                    }
+                    continue;
+                }
+                if (count == 0)
+                {
+                    // the client is done sending, answer what it already sent and close
+                    session->setClosing(true);
+                    break;
+                }
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    closeSession(session);
+                    return;
+                }
+                break;
+            }
+
+            dispatch(session);
+            // a saturated session stops being watched for input, until its queue and its output drain
+            if (session->getClosing() || isSaturated(*session))
+                writeSession(session);
+        }
+
+        void writeSession(shared_ptr<Session> session)
+        {
+            auto &writeBuffer = session->getWriteBuffer();
+            size_t written = 0;
+            while (written < writeBuffer.length())
+            {
+                auto count = send(session->getDescriptor(), writeBuffer.data() + written, writeBuffer.length() - written, MSG_NOSIGNAL);
+                if (count >= 0)
+                {
+                    written += count;
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                if (errno == EINTR)
+                    continue;
+                closeSession(session);
+                return;
+            }
+            writeBuffer.erase(0, written);
+
+            uint32_t events = session->getClosing() || isSaturated(*session) ? 0u : static_cast<uint32_t>(EPOLLIN);
+            if (!writeBuffer.empty())
+                events |= EPOLLOUT;
+            else if (session->getClosing() && !session->getBusy() && session->getPendingLines().empty())
+            {
+                closeSession(session);
+                return;
+            }
+            watch(session->getDescriptor(), events, EPOLL_CTL_MOD);
+        }
+
+        void collectCompletions()
+        {
+            uint64_t signals;
+            (void)!read(wakeDescriptor, &signals, sizeof(signals));
+
+            vector<pair<shared_ptr<Session>, string>> collected;
+            {
+                lock_guard<mutex> lock(completionsMutex);
+                collected.swap(completions);
+            }
+            for (auto &completion : collected)
+            {
+                auto session = completion.first;
+                session->setBusy(false);
+                if (session->getDescriptor() == -1)
+                    continue;
+                session->getWriteBuffer() += completion.second;
+                if (session->getExited())
+                {
+                    session->setClosing(true);
+                    session->getPendingLines().clear();
+                }
+                dispatch(session);
+                writeSession(session);
+            }
+        }
+
+    public:
+        Server(shared_ptr<DatabaseManager> manager, string address) : manager(manager), address(address), workerPool(1) {}
+        ~Server()
+        {
+            // running jobs still signal the wake descriptor, it is only closed once they are done
+            workerPool.stop();
+            for (auto &session : sessions)
+                close(session.first);
+            if (listenDescriptor != -1)
+                close(listenDescriptor);
+            if (wakeDescriptor != -1)
+                close(wakeDescriptor);
+            if (pollDescriptor != -1)
+                close(pollDescriptor);
+        }
+
+        void start()
+        {
+            listenDescriptor = openListener();
+            pollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+            wakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (pollDescriptor == -1 || wakeDescriptor == -1)
+                throw(ServerException("Could not set up the event loop: " + string(strerror(errno))));
+            watch(listenDescriptor, EPOLLIN);
+            watch(wakeDescriptor, EPOLLIN);
+
+            isRunning = true;
+            info("Server listening on " + address + ".");
+
+            epoll_event events[maximumEvents];
+            while (isRunning)
+            {
+                int count = epoll_wait(pollDescriptor, events, maximumEvents, -1);
+                if (count == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw(ServerException("Event loop failed: " + string(strerror(errno))));
+                }
+                for (int index = 0; index < count; index++)
+                {
+                    int descriptor = events[index].data.fd;
+                    if (descriptor == listenDescriptor)
+                    {
+                        acceptConnections();
+                        continue;
+                    }
+                    if (descriptor == wakeDescriptor)
+                    {
+                        collectCompletions();
+                        continue;
+                    }
+
+                    auto entry = sessions.find(descriptor);
+                    if (entry == sessions.end())
+                        continue;
+                    auto session = entry->second;
+                    if (events[index].events & (EPOLLERR | EPOLLHUP))
+                    {
+                        closeSession(session);
+                        continue;
+                    }
+                    if (events[index].events & EPOLLIN)
+                        readSession(session);
+                    if (session->getDescriptor() != -1 && (events[index].events & EPOLLOUT))
+                        writeSession(session);
+                }
+            }
+            info("Server stopped.");
+        }
+        void stop()
+        {
+            isRunning = false;
+            uint64_t signal = 1;
+            (void)!write(wakeDescriptor, &signal, sizeof(signal));
+        }
+    };
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <string_view>
+
+using namespace std;
+using namespace spdlog;
+using namespace formatting;
+using namespace std::chrono;
+
+namespace database
+{
+    enum class ExportFormat
+    {
+        CSV,
+        JSONLines
+    };
+
+    class ExportSummary
+    {
+    private:
+        long long rows;
+        long long bytes;
+        nanoseconds elapsed;
+
+    public:
+        ExportSummary(long long rows, long long bytes, nanoseconds elapsed) : rows(rows), bytes(bytes), elapsed(elapsed) {}
+        ~ExportSummary() {}
+
+        long long getRows() const { return rows; }
+        long long getBytes() const { return bytes; }
+        nanoseconds getElapsed() const { return elapsed; }
+
+        double getRowsPerSecond() const { return elapsed.count() == 0 ? 0 : rows / duration<double>(elapsed).count(); }
+        double getMegabytesPerSecond() const { return elapsed.count() == 0 ? 0 : bytes / (1024.0 * 1024.0) / duration<double>(elapsed).count(); }
+
+        string getDescription() const
+        {
+            return std::format("{} transactions ({} bytes) in {} ms, {:.0f} rows/s, {:.2f} MB/s",
+                               rows, bytes, duration_cast<milliseconds>(elapsed).count(), getRowsPerSecond(), getMegabytesPerSecond());
+        }
+    };
+
+    // exports transaction history straight from a COPY stream into a file, one row at a time,
+    // so memory use does not depend on the size of the history
+    class StatementExporter
+    {
+    private:
+        inline static const string selectColumns =
+            "SELECT t.id, to_char(t.date, 'YYYY-MM-DD HH24:MI:SS'), o.iban, i.iban, t.amount, c.code, ";
+        inline static const string joinedTables =
+            "FROM transactions t "
+            "JOIN accounts o ON o.id = t.outbound "
+            "JOIN accounts i ON i.id = t.inbound "
+            "JOIN currencies c ON c.id = o.currency ";
+
+        shared_ptr<Storage> storage;
+
+        // IBANs and currency codes are alphanumeric, so no field ever needs quoting or escaping
+        // the file is written to the output directory, whatever the client asked for
+        ExportSummary exportRows(Query &query, ExportFormat format, const string &fileName) const
+        {
+            auto filePath = OutputDirectory::resolve(fileName);
+            ofstream file(filePath, ios_base::out | ios_base::trunc);
+            if (!file.is_open())
+                throw(ValidationException("Could not open export file " + filePath + "!"));
+
+            auto start = steady_clock::now();
+            string buffer;
+            long long rows, bytes;
+            {
+                OutputBuffer output(file, buffer);
+                if (format == ExportFormat::CSV)
+                    output.write("id,date,outbound,inbound,amount,currency,direction\n");
+                rows = query.stream<long long, string_view, string_view, string_view, double, string_view, string_view>(
+                    [&output, format](const auto &row)
+                    {
+                        const auto &[id, date, outbound, inbound, amount, currency, direction] = row;
+                        if (format == ExportFormat::CSV)
+                            output.write("{},{},{},{},{},{},{}\n", id, date, outbound, inbound, amount, currency, direction);
+                        else
+                            output.write("{{\"id\":{},\"date\":\"{}\",\"outbound\":\"{}\",\"inbound\":\"{}\",\"amount\":{},\"currency\":\"{}\",\"direction\":\"{}\"}}\n",
+                                         id, date, outbound, inbound, amount, currency, direction);
+                    });
+                bytes = output.getWrittenBytes();
+            }
+            file.close();
+
+            ExportSummary summary(rows, bytes, steady_clock::now() - start);
+            info("Exported " + summary.getDescription() + " to " + filePath + ".");
+            return summary;
+        }
+
+    public:
+        StatementExporter(shared_ptr<Storage> storage) : storage(storage) {}
+        ~StatementExporter() = default;
+
+        // exports only read, so a replica may serve them
+        ExportSummary exportAccountTransactions(long long accountId, ExportFormat format, const string &fileName) const
+        {
+            ReadSession::ReplicaScope replicaScope;
+            Query query(storage->getReadConnection(), selectColumns +
+                                                          "CASE WHEN t.outbound = :directionAccount THEN 'outbound' ELSE 'inbound' END " +
+                                                          joinedTables +
+                                                          "WHERE t.inbound = :inboundAccount OR t.outbound = :outboundAccount ORDER BY t.date, t.id");
+            query.setParameter<long long>("directionAccount", accountId)
+                .setParameter<long long>("inboundAccount", accountId)
+                .setParameter<long long>("outboundAccount", accountId);
+            return exportRows(query, format, fileName);
+        }
+        ExportSummary exportUserTransactions(long long userId, ExportFormat format, const string &fileName) const
+        {
+            ReadSession::ReplicaScope replicaScope;
+            Query query(storage->getReadConnection(), selectColumns +
+                                                          "CASE WHEN o.associateduser = :internalOutboundUser AND i.associateduser = :internalInboundUser THEN 'internal' "
+                                                          "WHEN o.associateduser = :directionUser THEN 'outbound' ELSE 'inbound' END " +
+                                                          joinedTables +
+                                                          "WHERE o.associateduser = :outboundUser OR i.associateduser = :inboundUser ORDER BY t.date, t.id");
+            query.setParameter<long long>("internalOutboundUser", userId)
+                .setParameter<long long>("internalInboundUser", userId)
+                .setParameter<long long>("directionUser", userId)
+                .setParameter<long long>("outboundUser", userId)
+                .setParameter<long long>("inboundUser", userId);
+            return exportRows(query, format, fileName);
+        }
+    };
+};
\ No newline at end of file
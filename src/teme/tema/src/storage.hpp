@@ -0,0 +1,1150 @@
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <string>
+#include <sstream>
+#include <istream>
+#include <cstdint>
+#include <iterator>
+#include <format>
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+using namespace std;
+using namespace spdlog;
+using namespace metrics;
+using namespace tracing;
+using namespace exception;
+
+namespace database
+{
+    // a row handed out by a storage engine, its fields are only valid during the callback
+    class Record
+    {
+    private:
+        vector<string_view> fields;
+        // the names of the result set's columns, and a number telling result sets apart, 0 when the engine named
+        // no columns
+        vector<string_view> columns;
+        size_t layout = 0;
+
+        inline static atomic<size_t> layouts = 0;
+
+    public:
+        Record() {}
+        ~Record() {}
+
+        // set once per result set, before its rows are assigned; the names have to outlive the rows
+        void setColumns(const pqxx::result &result)
+        {
+            columns.clear();
+            for (pqxx::row_size_type column = 0; column < result.columns(); column++)
+                columns.emplace_back(result.column_name(column));
+            layout = ++layouts;
+        }
+        void setColumns(const vector<string> &names)
+        {
+            columns.assign(names.begin(), names.end());
+            layout = ++layouts;
+        }
+        void setColumns(const AsyncResult &result)
+        {
+            columns.clear();
+            for (int column = 0; column < result.getColumnCount(); column++)
+                columns.emplace_back(result.getColumnName(column));
+            layout = ++layouts;
+        }
+        size_t getLayout() const { return layout; }
+        size_t getColumn(string_view name) const
+        {
+            auto position = find(columns.begin(), columns.end(), name);
+            if (position == columns.end())
+                throw(EntryNotFoundException("Could not find column " + string(name) + " in the result set!"));
+            return position - columns.begin();
+        }
+
+        void assign(const pqxx::row &row)
+        {
+            fields.clear();
+            for (const auto &field : row)
+                fields.emplace_back(field.view());
+        }
+        void assign(const vector<string> &row)
+        {
+            fields.clear();
+            for (const auto &field : row)
+                fields.emplace_back(field);
+        }
+        void assign(const AsyncResult &result, int row)
+        {
+            fields.clear();
+            for (int column = 0; column < result.getColumnCount(); column++)
+                fields.emplace_back(result.getValue(row, column));
+        }
+
+        size_t size() const { return fields.size(); }
+        string_view operator[](size_t index) const { return fields.at(index); }
+
+        template <typename Type>
+        Type get(size_t index) const
+        {
+            auto field = fields.at(index);
+            if constexpr (is_same<Type, string>::value)
+                return string(field);
+            else if constexpr (is_same<Type, string_view>::value)
+                return field;
+            else if constexpr (is_same<Type, long long>::value || is_same<Type, double>::value)
+            {
+                Type value{};
+                auto [end, errorCode] = from_chars(field.data(), field.data() + field.size(), value);
+                if (errorCode != errc())
+                    throw(UnsupportedArgumentTypeException("Could not convert field " + string(field) + "!"));
+                return value;
+            }
+            else if constexpr (is_same<Type, time_point<system_clock>>::value)
+                return TimestampCodec::parse(field);
+            else
+                throw(UnsupportedArgumentTypeException());
+        }
+    };
+
+    // the positions of the columns an entity reads, looked up by name the first time a record of a result set
+    // comes in, so every other row is decoded by position; records without column names are taken to hold
+    // the columns in the listed order
+    class RecordBinding
+    {
+    private:
+        vector<string> columns;
+        vector<size_t> positions;
+        size_t layout = 0;
+
+    public:
+        RecordBinding(vector<string> columns) : columns(columns), positions(columns.size())
+        {
+            // PostgreSQL and the in-memory engine both fold names to lower case
+            for (auto &column : this->columns)
+                transform(column.begin(), column.end(), column.begin(), ::tolower);
+            for (size_t field = 0; field < positions.size(); field++)
+                positions[field] = field;
+        }
+        ~RecordBinding() {}
+
+        const RecordBinding &bind(const Record &record)
+        {
+            if (record.getLayout() == layout)
+                return *this;
+            for (size_t field = 0; field < columns.size(); field++)
+                positions[field] = record.getLayout() == 0 ? field : record.getColumn(columns[field]);
+            layout = record.getLayout();
+            return *this;
+        }
+        size_t operator[](size_t field) const { return positions[field]; }
+    };
+
+    using RecordCallback = function<void(const Record &)>;
+    // column name and value pairs, values are passed as text
+    using RecordValues = vector<pair<string, string>>;
+
+    // a change to a single row, found by its key, or a new row when there is no key. An increment adds to a
+    // column relative to the value it holds when the change is applied, so concurrent writers do not overwrite
+    // each other
+    class RowChange
+    {
+    private:
+        string table;
+        long long key;
+        RecordValues values;
+        bool increment = false;
+
+    public:
+        RowChange(string table, RecordValues values) : table(table), key(-1), values(values) {}
+        RowChange(string table, long long key, RecordValues values) : table(table), key(key), values(values) {}
+        RowChange(string table, long long key, string column, double amount)
+            : table(table), key(key), values{{column, std::format("{}", amount)}}, increment(true) {}
+        ~RowChange() {}
+
+        const string &getTable() const { return table; }
+        long long getKey() const { return key; }
+        bool isInsert() const { return key == -1; }
+        bool isIncrement() const { return increment; }
+        const RecordValues &getValues() const { return values; }
+    };
+
+    // what applying changes gave back: the key of the inserted row, -1 if there is none, and the values the
+    // increments left, in the order of the changes
+    class AppliedChanges
+    {
+    private:
+        long long insertedKey = -1;
+        vector<double> incrementedValues;
+
+    public:
+        AppliedChanges() {}
+        ~AppliedChanges() {}
+
+        long long getInsertedKey() const { return insertedKey; }
+        void setInsertedKey(long long key) { insertedKey = key; }
+        const vector<double> &getIncrementedValues() const { return incrementedValues; }
+        void addIncrementedValue(double value) { incrementedValues.emplace_back(value); }
+    };
+
+    // where a session's reads go when the engine has replicas. Only reads made inside a ReplicaScope, which
+    // read-only operations open, may go to a replica, and not while the session running on the thread is pinned
+    // to the primary: replicas lag behind, so a session that just wrote keeps reading from the primary for a
+    // while, and sees its own writes
+    class ReadSession
+    {
+    private:
+        time_point<steady_clock> lastWrite;
+
+        inline static atomic<long long> pinWindow = duration_cast<microseconds>(seconds(2)).count();
+        inline static atomic<size_t> openedScopes = 0;
+        inline static thread_local ReadSession *current = nullptr;
+        inline static thread_local size_t replicaScopes = 0;
+        inline static thread_local size_t scopeNumber = 0;
+
+    public:
+        ReadSession() : lastWrite(time_point<steady_clock>::min()) {}
+        ~ReadSession() = default;
+
+        static void setPinWindow(milliseconds window) { pinWindow = duration_cast<microseconds>(window).count(); }
+        static milliseconds getPinWindow() { return duration_cast<milliseconds>(microseconds(pinWindow.load())); }
+
+        // writes made outside of a session (i.e. while loading) pin nobody
+        static void recordWrite()
+        {
+            if (current != nullptr)
+                current->lastWrite = steady_clock::now();
+        }
+        static bool canReadReplica()
+        {
+            if (replicaScopes == 0)
+                return false;
+            return current == nullptr || current->lastWrite + microseconds(pinWindow.load(memory_order_relaxed)) <= steady_clock::now();
+        }
+        // every read of an operation goes to the same replica, operations take the replicas in turn
+        static size_t getScopeNumber() { return scopeNumber; }
+
+        // the session whose commands run on the thread
+        class Scope
+        {
+        private:
+            ReadSession *previous;
+
+        public:
+            Scope(ReadSession &session) : previous(current) { current = &session; }
+            ~Scope() { current = previous; }
+        };
+        class ReplicaScope
+        {
+        public:
+            ReplicaScope()
+            {
+                if (replicaScopes++ == 0)
+                    scopeNumber = openedScopes++;
+            }
+            ~ReplicaScope() { replicaScopes--; }
+        };
+    };
+
+    // operations the entities need from a storage engine, every table has an integer "id" primary key
+    class Storage
+    {
+    protected:
+        // reads the next statement of a script, semicolons inside quotes and $$ quoted bodies (i.e. functions) do not end it
+        static bool readStatement(istream &script, string &statement)
+        {
+            statement.clear();
+            bool quoted = false, dollarQuoted = false;
+            for (char character; script.get(character);)
+            {
+                if (character == ';' && !quoted && !dollarQuoted)
+                    return true;
+                statement += character;
+                if (character == '\'' && !dollarQuoted)
+                    quoted = !quoted;
+                else if (character == '$' && !quoted && statement.size() >= 2 && statement[statement.size() - 2] == '$')
+                    dollarQuoted = !dollarQuoted;
+            }
+            return !statement.empty();
+        }
+
+    public:
+        virtual ~Storage() = default;
+
+        virtual void initialize(istream &script) = 0;
+
+        virtual long long scan(const string &table, const RecordCallback &callback) = 0;
+        virtual long long findByKey(const string &table, long long key, const RecordCallback &callback) = 0;
+        // rows whose columns are equal to all of the given values
+        virtual long long findByIndex(const string &table, const map<string, string> &properties, const RecordCallback &callback) = 0;
+        // rows matching the properties with from <= column < to, ordered by the column; values are compared
+        // as text in memory, so dates have to be given as YYYY-MM-DD HH:MM:SS
+        virtual long long findByRange(const string &table, const map<string, string> &properties, const string &column, const string &from, const string &to,
+                                      const RecordCallback &callback) = 0;
+        // returns the key of the new row
+        virtual long long insert(const string &table, const RecordValues &values) = 0;
+        // inserts all rows at once, rows that would duplicate a unique value are skipped; returns the number inserted
+        virtual long long insertMany(const string &table, const vector<string> &columns, const vector<vector<string>> &rows) = 0;
+        virtual void update(const string &table, long long key, const RecordValues &values) = 0;
+        virtual void erase(const string &table, const string &property, const string &value) = 0;
+
+        // coroutine versions, for the paths that overlap their queries; engines that can keep queries in flight
+        // override them, the others (i.e. the in-memory one) complete them right away
+        virtual Task<long long> findByIndexAsync(string table, map<string, string> properties, RecordCallback callback)
+        {
+            co_return findByIndex(table, properties, callback);
+        }
+        virtual Task<long long> findByRangeAsync(string table, map<string, string> properties, string column, string from, string to, RecordCallback callback)
+        {
+            co_return findByRange(table, properties, column, from, to, callback);
+        }
+        // applies the changes in order, as a single transaction where the engine has them; an increment of a row
+        // that does not exist fails
+        virtual Task<AppliedChanges> applyAsync(vector<RowChange> changes)
+        {
+            AppliedChanges applied;
+            for (const auto &change : changes)
+                if (change.isInsert())
+                    applied.setInsertedKey(insert(change.getTable(), change.getValues()));
+                else if (change.isIncrement())
+                {
+                    const auto &[column, amount] = change.getValues().front();
+                    double value = 0;
+                    if (findByKey(change.getTable(), change.getKey(), [&value, &column](const Record &record)
+                                  { value = record.get<double>(record.getColumn(column)); }) == 0)
+                        throw(EntryNotFoundException("Could not find the row to update in " + change.getTable() + "!"));
+                    value += stod(amount);
+                    update(change.getTable(), change.getKey(), {{column, std::format("{}", value)}});
+                    applied.addIncrementedValue(value);
+                }
+                else
+                    update(change.getTable(), change.getKey(), change.getValues());
+            co_return applied;
+        }
+
+        // operations beyond this interface (exports, reports) run queries on the connection directly,
+        // engines without a database return an empty one, and those queries fail with StorageOperationUnsupportedException
+        virtual weak_ptr<pqxx::connection> getConnection() const { return weak_ptr<pqxx::connection>(); }
+        // the same for read-only queries, which may be served by a replica
+        virtual weak_ptr<pqxx::connection> getReadConnection() const { return getConnection(); }
+    };
+
+    class PostgresStorage : public Storage
+    {
+    private:
+        shared_ptr<pqxx::connection> connection;
+        // streaming replicas of the primary, for the reads of read-only operations
+        vector<shared_ptr<pqxx::connection>> replicas;
+        // opened the first time a coroutine path needs them, to the same databases
+        unique_ptr<AsyncConnection> asyncConnection;
+        vector<unique_ptr<AsyncConnection>> replicaAsyncConnections;
+
+        // the replica serving the current read, -1 for the primary; a replica is skipped once either of its
+        // connections is closed
+        long long getReadReplica() const
+        {
+            if (replicas.empty() || !ReadSession::canReadReplica())
+                return -1;
+            for (size_t attempt = 0; attempt < replicas.size(); attempt++)
+            {
+                auto replica = (ReadSession::getScopeNumber() + attempt) % replicas.size();
+                if (replicas[replica]->is_open() && (!replicaAsyncConnections[replica] || replicaAsyncConnections[replica]->isOpen()))
+                    return static_cast<long long>(replica);
+            }
+            return -1;
+        }
+        AsyncConnection &getAsyncConnection(long long replica = -1)
+        {
+            auto &slot = replica == -1 ? asyncConnection : replicaAsyncConnections[replica];
+            if (!slot)
+                slot = make_unique<AsyncConnection>((replica == -1 ? connection : replicas[replica])->connection_string());
+            return *slot;
+        }
+
+        // reads run on a replica when the session may read one, and again on the primary if the replica fails: it may
+        // have gone away, or cancelled the query while replaying the primary's changes
+        Task<vector<AsyncResult>> readAsync(AsyncStatement statement)
+        {
+            auto replica = getReadReplica();
+            if (replica != -1)
+            {
+                try
+                {
+                    co_return co_await getAsyncConnection(replica).execute(statement);
+                }
+                catch (pqxx::sql_error const &sqlError)
+                {
+                    warn("event=replica.read.failed replica={} message=\"{}\"", replica, string(sqlError.what()));
+                }
+            }
+            co_return co_await getAsyncConnection().execute(move(statement));
+        }
+
+        long long forEachRow(const pqxx::result &result, const RecordCallback &callback) const
+        {
+            static LatencyHistogram &parseHistogram = MetricsRegistry::getInstance().getHistogram("query.parse");
+            ThreadCounters::decodedRows += result.size();
+            ScopedTimer timer(parseHistogram);
+            TraceSpan span("query", "parse");
+            Record record;
+            record.setColumns(result);
+            for (const auto &row : result)
+            {
+                record.assign(row);
+                callback(record);
+            }
+            return result.size();
+        }
+        long long forEachRow(const AsyncResult &result, const RecordCallback &callback) const
+        {
+            static LatencyHistogram &parseHistogram = MetricsRegistry::getInstance().getHistogram("query.parse");
+            ThreadCounters::decodedRows += result.getRowCount();
+            ScopedTimer timer(parseHistogram);
+            TraceSpan span("query", "parse");
+            Record record;
+            record.setColumns(result);
+            for (int row = 0; row < result.getRowCount(); row++)
+            {
+                record.assign(result, row);
+                callback(record);
+            }
+            return result.getRowCount();
+        }
+        // "column=$1 AND ..." for the properties, whose values are added to the parameters
+        static string getConditions(const map<string, string> &properties, vector<string> &parameters)
+        {
+            string conditions;
+            for (const auto &property : properties)
+            {
+                parameters.emplace_back(property.second);
+                conditions += std::format("{}{}=${}", conditions.empty() ? "" : " AND ", property.first, parameters.size());
+            }
+            return conditions;
+        }
+
+        // the same conditions with the values quoted in place, for the queries sent through Query; values are always
+        // escaped by the connection, only table and column names, which the code itself picks, go in as they are
+        string getQuotedConditions(const map<string, string> &properties) const
+        {
+            string conditions;
+            for (const auto &property : properties)
+                conditions += std::format("{}{}={}", conditions.empty() ? "" : " AND ", property.first, connection->quote(property.second));
+            return conditions;
+        }
+
+        // FNV-1a, stable across builds, unlike std::hash
+        static uint64_t hashScript(const string &contents)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (unsigned char character : contents)
+                hash = (hash ^ character) * 1099511628211ull;
+            return hash;
+        }
+
+    public:
+        PostgresStorage(shared_ptr<pqxx::connection> connection, vector<shared_ptr<pqxx::connection>> replicas = {})
+            : connection(connection), replicas(replicas), replicaAsyncConnections(replicas.size())
+        {
+            info("Database connection opened, with {} replica connections.", replicas.size());
+        }
+        ~PostgresStorage()
+        {
+            asyncConnection.reset();
+            replicaAsyncConnections.clear();
+            for (auto &replica : replicas)
+                replica->close();
+            connection->close();
+            info("Database connection closed.");
+        }
+
+        static shared_ptr<PostgresStorage> connect(const string &connectionString, const vector<string> &replicaConnectionStrings)
+        {
+            vector<shared_ptr<pqxx::connection>> replicas;
+            for (const auto &replicaConnectionString : replicaConnectionStrings)
+                replicas.emplace_back(make_shared<pqxx::connection>(replicaConnectionString));
+            return make_shared<PostgresStorage>(make_shared<pqxx::connection>(connectionString), replicas);
+        }
+
+        // the script is applied as a single transaction, which also marks the schema with the hash of the script, so
+        // a database already initialized by the same script is recognized by one catalog query and left alone
+        void initialize(istream &script) override
+        {
+            string contents((istreambuf_iterator<char>(script)), istreambuf_iterator<char>());
+            auto marker = std::format("tema3 schema {:016x}", hashScript(contents));
+            try
+            {
+                Query check(connection, "SELECT obj_description(oid, 'pg_namespace') FROM pg_namespace WHERE nspname = current_schema();");
+                auto result = check.executeAutocommit();
+                if (!result.empty() && !result[0][0].is_null() && result[0][0].as<string>() == marker)
+                {
+                    info("event=schema.current marker=\"{}\"", marker);
+                    return;
+                }
+
+                auto start = steady_clock::now();
+                Query apply(connection, contents + "\n;\nDO $$ BEGIN EXECUTE format('COMMENT ON SCHEMA %I IS %L', current_schema(), '" + marker + "'); END $$;");
+                apply.execute();
+                info("event=schema.initialized marker=\"{}\" duration_ms={}", marker, duration_cast<milliseconds>(steady_clock::now() - start).count());
+            }
+            catch (pqxx::sql_error const &sqlError)
+            {
+                // nothing of the script was applied
+                error("SQL error: " + string(sqlError.what()));
+                throw;
+            }
+        }
+
+        long long scan(const string &table, const RecordCallback &callback) override
+        {
+            Query query(getReadConnection(), std::format("SELECT * FROM {};", table));
+            return forEachRow(query.execute(), callback);
+        }
+        long long findByKey(const string &table, long long key, const RecordCallback &callback) override
+        {
+            Query query(getReadConnection(), std::format("SELECT * FROM {} WHERE id={};", table, key));
+            return forEachRow(query.execute(), callback);
+        }
+        long long findByIndex(const string &table, const map<string, string> &properties, const RecordCallback &callback) override
+        {
+            Query query(getReadConnection(), std::format("SELECT * FROM {} WHERE {};", table, getQuotedConditions(properties)));
+            return forEachRow(query.execute(), callback);
+        }
+        // the bounds on the partition key let PostgreSQL skip the partitions outside of them
+        long long findByRange(const string &table, const map<string, string> &properties, const string &column, const string &from, const string &to,
+                              const RecordCallback &callback) override
+        {
+            auto conditions = getQuotedConditions(properties);
+            Query query(getReadConnection(), std::format("SELECT * FROM {0} WHERE {1}{2}{3}>={4} AND {3}<{5} ORDER BY {3};", table, conditions,
+                                                         conditions.empty() ? "" : " AND ", column, connection->quote(from), connection->quote(to)));
+            return forEachRow(query.execute(), callback);
+        }
+        Task<long long> findByIndexAsync(string table, map<string, string> properties, RecordCallback callback) override
+        {
+            vector<string> parameters;
+            auto conditions = getConditions(properties, parameters);
+            auto results = co_await readAsync(AsyncStatement(std::format("SELECT * FROM {} WHERE {};", table, conditions), parameters));
+            co_return forEachRow(results.front(), callback);
+        }
+        Task<long long> findByRangeAsync(string table, map<string, string> properties, string column, string from, string to, RecordCallback callback) override
+        {
+            vector<string> parameters;
+            auto conditions = getConditions(properties, parameters);
+            parameters.emplace_back(from);
+            parameters.emplace_back(to);
+            auto query = std::format("SELECT * FROM {0} WHERE {1}{2}{3}>=${4} AND {3}<${5} ORDER BY {3};", table, conditions, conditions.empty() ? "" : " AND ", column,
+                                     parameters.size() - 1, parameters.size());
+            auto results = co_await readAsync(AsyncStatement(query, parameters));
+            co_return forEachRow(results.front(), callback);
+        }
+        // sent as one batch, so the changes share a round trip and commit together; a statement that fails (i.e. an
+        // increment breaking a CHECK constraint) rolls back all of them
+        Task<AppliedChanges> applyAsync(vector<RowChange> changes) override
+        {
+            vector<AsyncStatement> statements;
+            for (const auto &change : changes)
+            {
+                vector<string> parameters;
+                string columns, values;
+                for (const auto &value : change.getValues())
+                {
+                    parameters.emplace_back(value.second);
+                    if (change.isInsert())
+                    {
+                        columns += (parameters.size() == 1 ? "" : ", ") + value.first;
+                        values += std::format("{}${}", parameters.size() == 1 ? "" : ", ", parameters.size());
+                    }
+                    else
+                        columns += std::format("{}{}=${}", parameters.size() == 1 ? "" : ", ", value.first, parameters.size());
+                }
+                if (change.isInsert())
+                    statements.emplace_back(std::format("INSERT INTO {} ({}) VALUES ({}) RETURNING id;", change.getTable(), columns, values), parameters);
+                else if (change.isIncrement())
+                {
+                    const auto &column = change.getValues().front().first;
+                    parameters.emplace_back(to_string(change.getKey()));
+                    statements.emplace_back(std::format("UPDATE {} SET {} = {} + $1 WHERE id=$2 RETURNING {};", change.getTable(), column, column, column), parameters);
+                }
+                else
+                {
+                    parameters.emplace_back(to_string(change.getKey()));
+                    statements.emplace_back(std::format("UPDATE {} SET {} WHERE id=${};", change.getTable(), columns, parameters.size()), parameters);
+                }
+            }
+
+            ReadSession::recordWrite();
+            auto results = co_await getAsyncConnection().execute(statements);
+            AppliedChanges applied;
+            for (size_t index = 0; index < changes.size(); index++)
+                if (changes[index].isInsert())
+                {
+                    long long insertedKey = -1;
+                    auto key = results[index].getValue(0, 0);
+                    from_chars(key.data(), key.data() + key.size(), insertedKey);
+                    applied.setInsertedKey(insertedKey);
+                }
+                else if (changes[index].isIncrement())
+                {
+                    // the batch has committed by now, a missing row only shows in the row count
+                    if (results[index].getRowCount() == 0)
+                        throw(EntrySynchronizationException("Could not find the row to update in " + changes[index].getTable() + "!"));
+                    double value = 0;
+                    auto field = results[index].getValue(0, 0);
+                    from_chars(field.data(), field.data() + field.size(), value);
+                    applied.addIncrementedValue(value);
+                }
+            co_return applied;
+        }
+        long long insert(const string &table, const RecordValues &values) override
+        {
+            ReadSession::recordWrite();
+            string columns, quotedValues;
+            for (size_t index = 0; index < values.size(); index++)
+            {
+                columns += (index == 0 ? "" : ", ") + values[index].first;
+                quotedValues += (index == 0 ? "" : ", ") + connection->quote(values[index].second);
+            }
+            Query query(connection, std::format("INSERT INTO {} ({}) VALUES ({}) RETURNING id;", table, columns, quotedValues));
+            return query.execute()[0][0].as<long long>();
+        }
+        long long insertMany(const string &table, const vector<string> &columns, const vector<vector<string>> &rows) override
+        {
+            if (rows.empty())
+                return 0;
+            ReadSession::recordWrite();
+            Query query(connection, "WITH inserted AS (INSERT INTO :table (");
+            query.setParameter<string>("table", table, false);
+            for (size_t index = 0; index < columns.size(); index++)
+                query.append(index == 0 ? ":column" : ", :column").setParameter<string>("column", columns[index], false);
+            // values are quoted as they are appended, replacing parameters one by one would rescan the whole statement every time
+            string values;
+            for (size_t row = 0; row < rows.size(); row++)
+            {
+                values += row == 0 ? "(" : ", (";
+                for (size_t index = 0; index < rows[row].size(); index++)
+                    values += (index == 0 ? "" : ", ") + connection->quote(rows[row][index]);
+                values += ")";
+            }
+            query.append(") VALUES ").append(values).append(" ON CONFLICT DO NOTHING RETURNING 1) SELECT count(*) FROM inserted;");
+            return query.execute()[0][0].as<long long>();
+        }
+        void update(const string &table, long long key, const RecordValues &values) override
+        {
+            ReadSession::recordWrite();
+            string assignments;
+            for (size_t index = 0; index < values.size(); index++)
+                assignments += std::format("{}{}={}", index == 0 ? "" : ", ", values[index].first, connection->quote(values[index].second));
+            Query query(connection, std::format("UPDATE {} SET {} WHERE id={};", table, assignments, key));
+            query.execute();
+        }
+        void erase(const string &table, const string &property, const string &value) override
+        {
+            ReadSession::recordWrite();
+            Query query(connection, std::format("DELETE FROM {} WHERE {}={};", table, property, connection->quote(value)));
+            query.execute();
+        }
+
+        weak_ptr<pqxx::connection> getConnection() const override { return connection; }
+        weak_ptr<pqxx::connection> getReadConnection() const override
+        {
+            auto replica = getReadReplica();
+            return replica == -1 ? connection : replicas[replica];
+        }
+    };
+
+    // embedded engine keeping every table in memory, rows are found through a hash index on the key and
+    // ordered indexes on the other columns, built the first time a column is searched and kept up to date
+    // afterwards; foreign keys are not enforced
+    class MemoryTable
+    {
+    private:
+        string name;
+        vector<string> columns;
+        set<size_t> uniqueColumns;
+        unordered_map<long long, vector<string>> rows;
+        map<size_t, multimap<string, long long>> indexes;
+        long long nextKey = 1;
+
+        multimap<string, long long> &getIndex(size_t column)
+        {
+            auto index = indexes.find(column);
+            if (index != indexes.end())
+                return index->second;
+            auto &newIndex = indexes[column];
+            for (const auto &row : rows)
+                newIndex.emplace(row.second[column], row.first);
+            return newIndex;
+        }
+        void indexRow(long long key, const vector<string> &row)
+        {
+            for (auto &index : indexes)
+                index.second.emplace(row[index.first], key);
+        }
+        void unindexRow(long long key, const vector<string> &row)
+        {
+            for (auto &index : indexes)
+            {
+                auto range = index.second.equal_range(row[index.first]);
+                for (auto entry = range.first; entry != range.second; entry++)
+                    if (entry->second == key)
+                    {
+                        index.second.erase(entry);
+                        break;
+                    }
+            }
+        }
+        void checkUnique(long long key, const vector<string> &row)
+        {
+            for (auto column : uniqueColumns)
+            {
+                auto range = getIndex(column).equal_range(row[column]);
+                for (auto entry = range.first; entry != range.second; entry++)
+                    if (entry->second != key)
+                        throw(EntryDuplicateFoundException("Duplicate value for unique property " + columns[column] + " in table " + name + "!"));
+            }
+        }
+
+    public:
+        MemoryTable(string name, vector<string> columns, set<size_t> uniqueColumns) : name(name), columns(columns), uniqueColumns(uniqueColumns) {}
+        ~MemoryTable() {}
+
+        // the key of the next row inserted without one, never below the keys already taken
+        void setNextKey(long long key) { nextKey = max(nextKey, key); }
+
+        size_t getColumn(const string &column) const
+        {
+            string lowerColumn = column;
+            transform(lowerColumn.begin(), lowerColumn.end(), lowerColumn.begin(), ::tolower);
+            auto position = find(columns.begin(), columns.end(), lowerColumn);
+            if (position == columns.end())
+                throw(EntryNotFoundException("Could not find column " + column + " in table " + name + "!"));
+            return position - columns.begin();
+        }
+
+        long long scan(const RecordCallback &callback) const
+        {
+            Record record;
+            record.setColumns(columns);
+            for (const auto &row : rows)
+            {
+                record.assign(row.second);
+                callback(record);
+            }
+            return rows.size();
+        }
+        long long findByKey(long long key, const RecordCallback &callback) const
+        {
+            auto row = rows.find(key);
+            if (row == rows.end())
+                return 0;
+            Record record;
+            record.setColumns(columns);
+            record.assign(row->second);
+            callback(record);
+            return 1;
+        }
+        long long findByIndex(const map<string, string> &properties, const RecordCallback &callback)
+        {
+            vector<pair<size_t, string>> conditions;
+            for (const auto &property : properties)
+                conditions.emplace_back(getColumn(property.first), property.second);
+            if (conditions.empty())
+                return scan(callback);
+            sort(conditions.begin(), conditions.end());
+
+            // the key column is searched through the hash index, any other through the first condition's index
+            vector<long long> keys;
+            if (conditions.front().first == 0)
+            {
+                long long key;
+                auto &value = conditions.front().second;
+                if (from_chars(value.data(), value.data() + value.size(), key).ec == errc() && rows.contains(key))
+                    keys.emplace_back(key);
+            }
+            else
+            {
+                auto range = getIndex(conditions.front().first).equal_range(conditions.front().second);
+                for (auto entry = range.first; entry != range.second; entry++)
+                    keys.emplace_back(entry->second);
+            }
+
+            Record record;
+            record.setColumns(columns);
+            long long count = 0;
+            for (auto key : keys)
+            {
+                const auto &row = rows.at(key);
+                if (!all_of(conditions.begin(), conditions.end(), [&row](const auto &condition)
+                            { return row[condition.first] == condition.second; }))
+                    continue;
+                record.assign(row);
+                callback(record);
+                count++;
+            }
+            return count;
+        }
+        long long findByRange(const map<string, string> &properties, const string &column, const string &from, const string &to, const RecordCallback &callback)
+        {
+            auto rangeColumn = getColumn(column);
+            vector<long long> keys;
+            if (properties.empty())
+            {
+                auto &index = getIndex(rangeColumn);
+                for (auto entry = index.lower_bound(from); entry != index.end() && entry->first < to; entry++)
+                    keys.emplace_back(entry->second);
+            }
+            else
+            {
+                vector<pair<string, long long>> matches;
+                findByIndex(properties, [&matches, rangeColumn, &from, &to](const Record &record)
+                            {
+                                auto value = record.get<string>(rangeColumn);
+                                if (value >= from && value < to)
+                                    matches.emplace_back(value, record.get<long long>(0)); });
+                sort(matches.begin(), matches.end());
+                for (const auto &match : matches)
+                    keys.emplace_back(match.second);
+            }
+
+            Record record;
+            record.setColumns(columns);
+            for (auto key : keys)
+            {
+                record.assign(rows.at(key));
+                callback(record);
+            }
+            return keys.size();
+        }
+        long long insert(const RecordValues &values)
+        {
+            vector<string> row(columns.size());
+            long long key = nextKey;
+            for (const auto &value : values)
+            {
+                auto column = getColumn(value.first);
+                row[column] = value.second;
+                if (column == 0)
+                    key = stoll(value.second);
+            }
+            if (rows.contains(key))
+                throw(EntryDuplicateFoundException("Duplicate key " + to_string(key) + " in table " + name + "!"));
+            row[0] = to_string(key);
+            checkUnique(key, row);
+            nextKey = max(nextKey, key + 1);
+            indexRow(key, row);
+            rows.emplace(key, move(row));
+            return key;
+        }
+        void update(long long key, const RecordValues &values)
+        {
+            auto entry = rows.find(key);
+            if (entry == rows.end())
+                return;
+            auto row = entry->second;
+            for (const auto &value : values)
+                row[getColumn(value.first)] = value.second;
+            checkUnique(key, row);
+            unindexRow(key, entry->second);
+            entry->second = move(row);
+            indexRow(key, entry->second);
+        }
+        void erase(const string &property, const string &value)
+        {
+            vector<long long> keys;
+            findByIndex({{property, value}}, [&keys](const Record &record)
+                        { keys.emplace_back(record.get<long long>(0)); });
+            for (auto key : keys)
+            {
+                unindexRow(key, rows.at(key));
+                rows.erase(key);
+            }
+        }
+    };
+
+    class MemoryStorage : public Storage
+    {
+    private:
+        map<string, MemoryTable> tables;
+        // tables without an id key, which only direct queries use
+        set<string> skippedTables;
+        // the START of every sequence, given to the tables whose id defaults to it
+        map<string, long long> sequenceStarts;
+
+        static string toLower(string value)
+        {
+            transform(value.begin(), value.end(), value.begin(), ::tolower);
+            return value;
+        }
+        static string trim(const string &value)
+        {
+            auto start = value.find_first_not_of(" \t\r\n");
+            if (start == string::npos)
+                return "";
+            return value.substr(start, value.find_last_not_of(" \t\r\n") - start + 1);
+        }
+        // splits on the separator, outside of parentheses and quotes
+        static vector<string> split(const string &value, char separator)
+        {
+            vector<string> parts;
+            string part;
+            int depth = 0;
+            bool quoted = false;
+            for (char character : value)
+            {
+                if (character == '\'')
+                    quoted = !quoted;
+                else if (!quoted && character == '(')
+                    depth++;
+                else if (!quoted && character == ')')
+                    depth--;
+                if (!quoted && depth == 0 && character == separator)
+                {
+                    parts.emplace_back(trim(part));
+                    part.clear();
+                }
+                else
+                    part += character;
+            }
+            if (!trim(part).empty())
+                parts.emplace_back(trim(part));
+            return parts;
+        }
+        static string unquote(const string &value)
+        {
+            if (value.size() < 2 || value.front() != '\'')
+                return value;
+            string result;
+            for (size_t index = 1; index + 1 < value.size(); index++)
+            {
+                result += value[index];
+                if (value[index] == '\'')
+                    index++;
+            }
+            return result;
+        }
+        // the contents of the first parentheses after start, up to the matching closing one
+        static string between(const string &value, size_t start)
+        {
+            auto open = value.find('(', start);
+            if (open == string::npos)
+                throw(ValidationException("Malformed statement " + value + "!"));
+            int depth = 0;
+            bool quoted = false;
+            for (auto close = open; close < value.size(); close++)
+            {
+                if (value[close] == '\'')
+                    quoted = !quoted;
+                else if (!quoted && value[close] == '(')
+                    depth++;
+                else if (!quoted && value[close] == ')' && --depth == 0)
+                    return value.substr(open + 1, close - open - 1);
+            }
+            throw(ValidationException("Malformed statement " + value + "!"));
+        }
+
+        MemoryTable &getTable(const string &table)
+        {
+            auto entry = tables.find(toLower(table));
+            if (entry == tables.end())
+                throw(EntryNotFoundException("Could not find table " + table + "!"));
+            return entry->second;
+        }
+
+        // CREATE TABLE name (column type [UNIQUE | PRIMARY KEY] ..., ...), partitions are part of their table here
+        void createTable(const string &statement)
+        {
+            if (toLower(statement).find(" partition of ") != string::npos)
+                return;
+            istringstream tokens(statement);
+            string name;
+            for (string token; tokens >> token;)
+            {
+                string upperToken = token;
+                transform(upperToken.begin(), upperToken.end(), upperToken.begin(), ::toupper);
+                if (token.find('(') != string::npos || (upperToken != "CREATE" && upperToken != "TABLE" && upperToken != "IF" && upperToken != "NOT" && upperToken != "EXISTS"))
+                {
+                    name = toLower(token.substr(0, token.find('(')));
+                    break;
+                }
+            }
+            if (tables.contains(name))
+                return;
+
+            vector<string> columns;
+            set<size_t> uniqueColumns;
+            for (const auto &definition : split(between(statement, 0), ','))
+            {
+                string upperDefinition = definition;
+                transform(upperDefinition.begin(), upperDefinition.end(), upperDefinition.begin(), ::toupper);
+                // table constraints, keys are only ever looked up by id
+                if (upperDefinition.starts_with("PRIMARY KEY") || upperDefinition.starts_with("UNIQUE") || upperDefinition.starts_with("CONSTRAINT") ||
+                    upperDefinition.starts_with("FOREIGN KEY") || upperDefinition.starts_with("CHECK"))
+                    continue;
+                columns.emplace_back(toLower(definition.substr(0, definition.find_first_of(" \t\r\n"))));
+                if (upperDefinition.find("UNIQUE") != string::npos && upperDefinition.find("PRIMARY KEY") == string::npos)
+                    uniqueColumns.insert(columns.size() - 1);
+            }
+            if (columns.empty() || columns.front() != "id")
+            {
+                debug("In-memory storage skipped table " + name + " without an id column.");
+                skippedTables.insert(name);
+                return;
+            }
+            tables.emplace(name, MemoryTable(name, columns, uniqueColumns));
+        }
+        // CREATE SEQUENCE [IF NOT EXISTS] name ... [START [WITH] value] ...
+        void createSequence(const string &statement)
+        {
+            istringstream tokens(toLower(statement));
+            string token, name;
+            tokens >> token >> token;
+            while (tokens >> name && (name == "if" || name == "not" || name == "exists"))
+                ;
+            long long start = 1;
+            while (tokens >> token)
+                if (token == "start")
+                {
+                    tokens >> token;
+                    if (token == "with")
+                        tokens >> token;
+                    start = stoll(token);
+                }
+            sequenceStarts[name.substr(name.find('.') + 1)] = start;
+        }
+        // ALTER TABLE name ALTER COLUMN id SET DEFAULT nextval('sequence'), the table's keys then start from the sequence's
+        void setDefault(const string &statement)
+        {
+            auto lowerStatement = toLower(statement);
+            auto nextval = lowerStatement.find("nextval(");
+            if (nextval == string::npos)
+            {
+                debug("In-memory storage skipped statement: " + statement);
+                return;
+            }
+            istringstream tokens(lowerStatement);
+            string token, name;
+            tokens >> token >> token >> name;
+            if (skippedTables.contains(name))
+                return;
+            auto sequence = unquote(trim(between(lowerStatement, nextval)));
+            sequence = sequence.substr(sequence.find('.') + 1);
+            auto start = sequenceStarts.find(sequence);
+            if (start == sequenceStarts.end())
+                throw(EntryNotFoundException("Could not find sequence " + sequence + "!"));
+            getTable(name).setNextKey(start->second);
+        }
+        // (SELECT column FROM name WHERE property = value), the column of the matching row
+        string selectValue(const string &subquery)
+        {
+            istringstream tokens(between(subquery, 0));
+            string token, column, name, property, value;
+            tokens >> token >> column >> token >> name >> token >> property >> token;
+            getline(tokens, value);
+            optional<string> result;
+            getTable(name).findByIndex({{toLower(property), unquote(trim(value))}}, [&result, &column](const Record &record)
+                                       { result = record.get<string>(record.getColumn(toLower(column))); });
+            if (!result)
+                throw(EntryNotFoundException("Could not find entry for subquery " + subquery + "!"));
+            return *result;
+        }
+        // INSERT INTO name (column, ...) VALUES (value, ...), ...
+        void insertRows(const string &statement)
+        {
+            auto valuesPosition = toLower(statement).find("values");
+            string head = statement.substr(0, valuesPosition);
+            istringstream tokens(head);
+            string token, name;
+            tokens >> token >> token >> name;
+            name = toLower(name.substr(0, name.find('(')));
+            if (skippedTables.contains(name))
+                return;
+
+            auto columns = split(between(head, 0), ',');
+            for (const auto &tuple : split(statement.substr(valuesPosition + 6), ','))
+            {
+                auto values = split(between(tuple, 0), ',');
+                RecordValues recordValues;
+                for (size_t index = 0; index < columns.size() && index < values.size(); index++)
+                    if (toLower(values[index]).starts_with("(select"))
+                        recordValues.emplace_back(columns[index], selectValue(values[index]));
+                    else if (toLower(values[index]) != "default")
+                        recordValues.emplace_back(columns[index], unquote(values[index]));
+                getTable(name).insert(recordValues);
+            }
+        }
+
+    public:
+        MemoryStorage() { info("In-memory storage opened."); }
+        ~MemoryStorage() { info("In-memory storage closed."); }
+
+        // only table and sequence definitions, id defaults and inserts are understood, other statements are skipped
+        void initialize(istream &script) override
+        {
+            for (string statement; readStatement(script, statement);)
+            {
+                statement = trim(statement);
+                string upperStatement = statement.substr(0, 15);
+                transform(upperStatement.begin(), upperStatement.end(), upperStatement.begin(), ::toupper);
+                try
+                {
+                    if (upperStatement.starts_with("CREATE TABLE"))
+                        createTable(statement);
+                    else if (upperStatement.starts_with("CREATE SEQUENCE"))
+                        createSequence(statement);
+                    else if (upperStatement.starts_with("ALTER TABLE"))
+                        setDefault(statement);
+                    else if (upperStatement.starts_with("INSERT INTO"))
+                        insertRows(statement);
+                    else if (!statement.empty())
+                        debug("In-memory storage skipped statement: " + statement);
+                }
+                catch (std::exception const &exception)
+                {
+                    error("In-memory storage error: " + string(exception.what()));
+                }
+            }
+        }
+
+        long long scan(const string &table, const RecordCallback &callback) override { return getTable(table).scan(callback); }
+        long long findByKey(const string &table, long long key, const RecordCallback &callback) override { return getTable(table).findByKey(key, callback); }
+        long long findByIndex(const string &table, const map<string, string> &properties, const RecordCallback &callback) override
+        {
+            return getTable(table).findByIndex(properties, callback);
+        }
+        long long findByRange(const string &table, const map<string, string> &properties, const string &column, const string &from, const string &to,
+                              const RecordCallback &callback) override
+        {
+            return getTable(table).findByRange(properties, column, from, to, callback);
+        }
+        long long insert(const string &table, const RecordValues &values) override { return getTable(table).insert(values); }
+        long long insertMany(const string &table, const vector<string> &columns, const vector<vector<string>> &rows) override
+        {
+            auto &memoryTable = getTable(table);
+            long long inserted = 0;
+            for (const auto &row : rows)
+            {
+                RecordValues values;
+                for (size_t index = 0; index < columns.size() && index < row.size(); index++)
+                    values.emplace_back(columns[index], row[index]);
+                try
+                {
+                    memoryTable.insert(values);
+                    inserted++;
+                }
+                catch (EntryDuplicateFoundException const &)
+                {
+                }
+            }
+            return inserted;
+        }
+        void update(const string &table, long long key, const RecordValues &values) override { getTable(table).update(key, values); }
+        void erase(const string &table, const string &property, const string &value) override { getTable(table).erase(property, value); }
+    };
+};
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include <array>
+#include <chrono>
+#include <string>
+#include <format>
+#include <string_view>
+
+using namespace std;
+using namespace exception;
+using namespace std::chrono;
+
+namespace database
+{
+    // timestamps are kept as text, "YYYY-MM-DD HH:MM:SS" in UTC, the way std::format writes a system_clock time;
+    // they are read and written by hand rather than through streams, so no locale, time zone or allocation is involved
+    class TimestampCodec
+    {
+    public:
+        // "YYYY-MM-DD HH:MM:SS"
+        inline static const size_t length = 19;
+
+    private:
+        static bool readDigits(string_view text, size_t position, size_t count, int &value)
+        {
+            if (position + count > text.size())
+                return false;
+            value = 0;
+            for (size_t index = position; index < position + count; index++)
+            {
+                if (text[index] < '0' || text[index] > '9')
+                    return false;
+                value = value * 10 + (text[index] - '0');
+            }
+            return true;
+        }
+        static void writeDigits(char *buffer, unsigned value, size_t count)
+        {
+            for (size_t index = count; index > 0; index--)
+            {
+                buffer[index - 1] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+        }
+
+    public:
+        // accepts a date, optionally followed by ' ' (or 'T') and a time, whose fraction of a second is dropped
+        static bool parse(string_view text, time_point<system_clock> &result)
+        {
+            int yearValue, monthValue, dayValue, hours = 0, minutes = 0, seconds = 0;
+            if (!readDigits(text, 0, 4, yearValue) || text.size() < 10 || text[4] != '-' || !readDigits(text, 5, 2, monthValue) || text[7] != '-' ||
+                !readDigits(text, 8, 2, dayValue))
+                return false;
+            if (text.size() > 10)
+            {
+                if ((text[10] != ' ' && text[10] != 'T') || !readDigits(text, 11, 2, hours) || text.size() < length || text[13] != ':' ||
+                    !readDigits(text, 14, 2, minutes) || text[16] != ':' || !readDigits(text, 17, 2, seconds))
+                    return false;
+                if (text.size() > length && text[length] != '.')
+                    return false;
+                if (hours > 23 || minutes > 59 || seconds > 59)
+                    return false;
+            }
+            year_month_day date{year(yearValue), month(static_cast<unsigned>(monthValue)), day(static_cast<unsigned>(dayValue))};
+            if (!date.ok())
+                return false;
+            result = sys_days(date) + std::chrono::hours(hours) + std::chrono::minutes(minutes) + std::chrono::seconds(seconds);
+            return true;
+        }
+        static time_point<system_clock> parse(string_view text)
+        {
+            time_point<system_clock> result;
+            if (!parse(text, result))
+                throw(ValidationException("Malformed timestamp " + string(text) + ", expected YYYY-MM-DD HH:MM:SS!"));
+            return result;
+        }
+
+        // writes exactly length characters, without a terminator
+        static void format(time_point<system_clock> at, char *buffer)
+        {
+            auto second = floor<std::chrono::seconds>(at);
+            auto dayStart = floor<days>(second);
+            year_month_day date(dayStart);
+            hh_mm_ss<std::chrono::seconds> time(second - dayStart);
+            writeDigits(buffer, static_cast<unsigned>(static_cast<int>(date.year())), 4);
+            buffer[4] = '-';
+            writeDigits(buffer + 5, static_cast<unsigned>(date.month()), 2);
+            buffer[7] = '-';
+            writeDigits(buffer + 8, static_cast<unsigned>(date.day()), 2);
+            buffer[10] = ' ';
+            writeDigits(buffer + 11, static_cast<unsigned>(time.hours().count()), 2);
+            buffer[13] = ':';
+            writeDigits(buffer + 14, static_cast<unsigned>(time.minutes().count()), 2);
+            buffer[16] = ':';
+            writeDigits(buffer + 17, static_cast<unsigned>(time.seconds().count()), 2);
+        }
+        static string format(time_point<system_clock> at)
+        {
+            array<char, length> buffer;
+            format(at, buffer.data());
+            return string(buffer.data(), buffer.size());
+        }
+    };
+};
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <format>
+#include <iterator>
+#include <string_view>
+#include <algorithm>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace tracing
+{
+    // a completed span, names are copied so spans may be named after commands and tables
+    class TraceEvent
+    {
+    public:
+        inline static const size_t maximumNameLength = 47;
+
+        const char *category = "";
+        array<char, maximumNameLength + 1> name{};
+        int64_t start = 0;
+        int64_t duration = 0;
+    };
+
+    // an event as stored in a buffer, every field is a relaxed atomic so the dumping thread may read it while
+    // the owning thread writes it; the sequence is odd during a write and 2 * (position + 1) after it, so a
+    // copy taken while the slot changed is recognized and dropped
+    class TraceSlot
+    {
+    public:
+        inline static const size_t nameWords = (TraceEvent::maximumNameLength + 1) / sizeof(uint64_t);
+
+        atomic<uint64_t> sequence = 0;
+        atomic<const char *> category = "";
+        array<atomic<uint64_t>, nameWords> name{};
+        atomic<int64_t> start = 0;
+        atomic<int64_t> duration = 0;
+    };
+
+    // written only by its own thread, other threads only read it; clearing moves the first
+    // position that is dumped instead of touching the head
+    class ThreadTraceBuffer
+    {
+    public:
+        inline static const size_t capacity = 16 * 1024;
+
+        array<TraceSlot, capacity> slots;
+        atomic<uint64_t> head = 0;
+        atomic<uint64_t> cleared = 0;
+        long long threadId;
+
+        ThreadTraceBuffer(long long threadId) : threadId(threadId) {}
+        ThreadTraceBuffer(const ThreadTraceBuffer &) = delete;
+        ~ThreadTraceBuffer() {}
+
+        void record(const char *category, string_view name, int64_t start, int64_t duration)
+        {
+            auto position = head.load(memory_order_relaxed);
+            auto &slot = slots[position % capacity];
+            slot.sequence.store(2 * position + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+
+            array<char, TraceEvent::maximumNameLength + 1> characters{};
+            copy_n(name.data(), min(name.size(), TraceEvent::maximumNameLength), characters.data());
+            for (size_t word = 0; word < TraceSlot::nameWords; word++)
+            {
+                uint64_t value;
+                memcpy(&value, characters.data() + word * sizeof(uint64_t), sizeof(uint64_t));
+                slot.name[word].store(value, memory_order_relaxed);
+            }
+            slot.category.store(category, memory_order_relaxed);
+            slot.start.store(start, memory_order_relaxed);
+            slot.duration.store(duration, memory_order_relaxed);
+
+            slot.sequence.store(2 * (position + 1), memory_order_release);
+            head.store(position + 1, memory_order_release);
+        }
+        vector<TraceEvent> getEvents() const
+        {
+            auto end = head.load(memory_order_acquire);
+            auto begin = max(end > capacity ? end - capacity : 0, cleared.load(memory_order_acquire));
+            vector<TraceEvent> result;
+            result.reserve(end > begin ? end - begin : 0);
+            for (auto position = begin; position < end; position++)
+            {
+                const auto &slot = slots[position % capacity];
+                auto expected = 2 * (position + 1);
+                if (slot.sequence.load(memory_order_acquire) != expected)
+                    continue;
+                TraceEvent event;
+                event.category = slot.category.load(memory_order_relaxed);
+                for (size_t word = 0; word < TraceSlot::nameWords; word++)
+                {
+                    auto value = slot.name[word].load(memory_order_relaxed);
+                    memcpy(event.name.data() + word * sizeof(uint64_t), &value, sizeof(uint64_t));
+                }
+                event.start = slot.start.load(memory_order_relaxed);
+                event.duration = slot.duration.load(memory_order_relaxed);
+                // the writer got to the slot while it was copied
+                atomic_thread_fence(memory_order_acquire);
+                if (slot.sequence.load(memory_order_relaxed) != expected)
+                    continue;
+                result.emplace_back(event);
+            }
+            return result;
+        }
+        void clear() { cleared.store(head.load(memory_order_acquire), memory_order_release); }
+    };
+
+    class Tracer
+    {
+    private:
+        inline static atomic<bool> enabled = false;
+
+        mutex buffersMutex;
+        vector<shared_ptr<ThreadTraceBuffer>> buffers;
+        time_point<steady_clock> origin = steady_clock::now();
+
+        Tracer() {}
+
+    public:
+        Tracer(const Tracer &) = delete;
+        ~Tracer() {}
+
+        static Tracer &getInstance()
+        {
+            static Tracer instance;
+            return instance;
+        }
+
+        // checked by every span, so a disabled tracer costs a single relaxed load
+        static bool isEnabled() { return enabled.load(memory_order_relaxed); }
+        static void setEnabled(bool value) { enabled.store(value, memory_order_relaxed); }
+
+        int64_t getTimestamp() const { return duration_cast<nanoseconds>(steady_clock::now() - origin).count(); }
+
+        // buffers outlive their threads, so spans of finished threads can still be dumped
+        ThreadTraceBuffer &getThreadBuffer()
+        {
+            thread_local shared_ptr<ThreadTraceBuffer> buffer;
+            if (!buffer)
+            {
+                lock_guard<mutex> lock(buffersMutex);
+                buffer = make_shared<ThreadTraceBuffer>(buffers.size() + 1);
+                buffers.emplace_back(buffer);
+            }
+            return *buffer;
+        }
+
+        void clear()
+        {
+            lock_guard<mutex> lock(buffersMutex);
+            for (auto &buffer : buffers)
+                buffer->clear();
+        }
+
+        // Chrome Trace Event format, which Perfetto and chrome://tracing open, span names are
+        // command, table and operation names, none of which need escaping
+        long long writeChromeTrace(ostream &out)
+        {
+            vector<shared_ptr<ThreadTraceBuffer>> currentBuffers;
+            {
+                lock_guard<mutex> lock(buffersMutex);
+                currentBuffers = buffers;
+            }
+
+            auto iterator = ostreambuf_iterator<char>(out);
+            format_to(iterator, "{{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+            long long count = 0;
+            for (const auto &buffer : currentBuffers)
+            {
+                format_to(iterator, "{}\n{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"thread {}\"}}}}",
+                          count == 0 ? "" : ",", buffer->threadId, buffer->threadId);
+                count++;
+                for (const auto &event : buffer->getEvents())
+                {
+                    format_to(iterator, ",\n{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+                              event.name.data(), event.category, buffer->threadId, event.start / 1000.0, event.duration / 1000.0);
+                    count++;
+                }
+            }
+            format_to(iterator, "\n]}}\n");
+            return count - currentBuffers.size();
+        }
+    };
+
+    class TraceSpan
+    {
+    private:
+        const char *category;
+        array<char, TraceEvent::maximumNameLength + 1> name;
+        size_t nameLength = 0;
+        int64_t start = -1;
+
+    public:
+        TraceSpan(const char *category, string_view name) : category(category)
+        {
+            if (!Tracer::isEnabled())
+                return;
+            nameLength = min(name.size(), TraceEvent::maximumNameLength);
+            copy_n(name.data(), nameLength, this->name.data());
+            start = Tracer::getInstance().getTimestamp();
+        }
+        // i.e. "users" and "load" into "users.load"
+        TraceSpan(const char *category, string_view prefix, string_view suffix) : category(category)
+        {
+            if (!Tracer::isEnabled())
+                return;
+            auto result = format_to_n(this->name.data(), TraceEvent::maximumNameLength, "{}.{}", prefix, suffix);
+            nameLength = min<size_t>(result.size, TraceEvent::maximumNameLength);
+            start = Tracer::getInstance().getTimestamp();
+        }
+        TraceSpan(const TraceSpan &) = delete;
+        ~TraceSpan()
+        {
+            if (start < 0)
+                return;
+            auto &tracer = Tracer::getInstance();
+            tracer.getThreadBuffer().record(category, string_view(name.data(), nameLength), start, tracer.getTimestamp() - start);
+        }
+    };
+};
\ No newline at end of file
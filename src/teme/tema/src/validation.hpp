@@ -9,6 +9,9 @@ namespace validation
     {
     private:
         inline static const regex emailRegex{"^[a-zA-Z0-9][a-zA-Z0-9_.]+@[a-zA-Z0-9_]+.[a-zA-Z0-9_.]+$"};
+        inline static const regex dateRegex{"^[0-9]{4}-[0-9]{2}-[0-9]{2}$"};
+        inline static const regex timestampRegex{"^[0-9]{4}-[0-9]{2}-[0-9]{2}( [0-9]{2}:[0-9]{2}:[0-9]{2})?$"};
+        inline static const regex monthRegex{"^[0-9]{4}-(0[1-9]|1[0-2])$"};
         inline static const string specialCharacters = "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
 
     public:
@@ -32,5 +35,18 @@ namespace validation
         {
             return regex_search(email, emailRegex);
         }
+        inline static const bool isDate(const string &date) noexcept
+        {
+            return regex_search(date, dateRegex);
+        }
+        // a date, optionally followed by a time of day
+        inline static const bool isTimestamp(const string &timestamp) noexcept
+        {
+            return regex_search(timestamp, timestampRegex);
+        }
+        inline static const bool isMonth(const string &month) noexcept
+        {
+            return regex_search(month, monthRegex);
+        }
     };
 };
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <format>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace std;
+using namespace metrics;
+using namespace exception;
+using namespace std::chrono;
+
+namespace database
+{
+    // the most transfers, and the largest total amount, allowed within a window
+    class VelocityLimit
+    {
+    private:
+        long long maximumCount;
+        double maximumAmount;
+
+    public:
+        VelocityLimit(long long maximumCount, double maximumAmount) : maximumCount(maximumCount), maximumAmount(maximumAmount) {}
+        ~VelocityLimit() {}
+
+        long long getMaximumCount() const { return maximumCount; }
+        double getMaximumAmount() const { return maximumAmount; }
+    };
+
+    // counts and sums transfers over a window split into buckets kept in a ring; a bucket is reset when the
+    // window comes around to it again, so the totals are those of the last window, give or take a bucket
+    class SlidingWindow
+    {
+    private:
+        struct Bucket
+        {
+            int64_t slot = -1;
+            long long count = 0;
+            double amount = 0;
+        };
+
+        int64_t bucketSeconds;
+        vector<Bucket> buckets;
+
+    public:
+        SlidingWindow(seconds window, size_t bucketCount) : bucketSeconds(max<int64_t>(1, window.count() / bucketCount)), buckets(bucketCount) {}
+        ~SlidingWindow() {}
+
+        void add(int64_t second, double amount)
+        {
+            if (second < 0)
+                return;
+            auto slot = second / bucketSeconds;
+            auto &bucket = buckets[slot % buckets.size()];
+            if (bucket.slot != slot)
+                bucket = Bucket{slot, 0, 0};
+            bucket.count++;
+            bucket.amount += amount;
+        }
+        // count and amount of the transfers in the window ending at the given second
+        pair<long long, double> getTotals(int64_t second) const
+        {
+            auto slot = second / bucketSeconds;
+            auto oldestSlot = slot - static_cast<int64_t>(buckets.size());
+            long long count = 0;
+            double amount = 0;
+            for (const auto &bucket : buckets)
+                if (bucket.slot > oldestSlot && bucket.slot <= slot)
+                {
+                    count += bucket.count;
+                    amount += bucket.amount;
+                }
+            return make_pair(count, amount);
+        }
+    };
+
+    // per account and per user transfer limits over the last minute, hour and day, checked on every transfer
+    // against counters kept in memory, so the check needs no query. Amounts are compared in limitCurrency
+    class VelocityTracker
+    {
+    public:
+        inline static const string limitCurrency = "EUR";
+
+    private:
+        inline static const size_t windowCount = 3;
+        inline static const array<string, windowCount> windowNames = {"minute", "hour", "day"};
+        inline static const array<seconds, windowCount> windowLengths = {minutes(1), hours(1), hours(24)};
+        inline static const array<size_t, windowCount> windowBuckets = {12, 60, 96};
+        // keys idle for longer than the longest window are dropped every this many transfers
+        inline static const size_t pruneInterval = 4096;
+
+        inline static bool enabled = true;
+        inline static array<VelocityLimit, windowCount> accountLimits = {VelocityLimit(10, 10000), VelocityLimit(60, 50000), VelocityLimit(200, 200000)};
+        inline static array<VelocityLimit, windowCount> userLimits = {VelocityLimit(20, 20000), VelocityLimit(120, 100000), VelocityLimit(500, 500000)};
+
+        class Windows
+        {
+        private:
+            vector<SlidingWindow> windows;
+            int64_t lastSecond = 0;
+
+        public:
+            Windows()
+            {
+                for (size_t window = 0; window < windowCount; window++)
+                    windows.emplace_back(windowLengths[window], windowBuckets[window]);
+            }
+
+            int64_t getLastSecond() const { return lastSecond; }
+            void add(int64_t second, double amount)
+            {
+                for (auto &window : windows)
+                    window.add(second, amount);
+                lastSecond = max(lastSecond, second);
+            }
+            pair<long long, double> getTotals(size_t window, int64_t second) const { return windows[window].getTotals(second); }
+        };
+
+        unordered_map<long long, Windows> accounts;
+        unordered_map<long long, Windows> users;
+        size_t recorded = 0;
+
+        LatencyHistogram &checkHistogram = MetricsRegistry::getInstance().getHistogram("velocity.check");
+        Counter &rejectionCounter = MetricsRegistry::getInstance().getCounter("velocity.rejections");
+
+        static int64_t toSecond(time_point<system_clock> at) { return duration_cast<seconds>(at.time_since_epoch()).count(); }
+
+        void checkLimits(const unordered_map<long long, Windows> &keys, const array<VelocityLimit, windowCount> &limits, const string &owner, long long key,
+                         double amount, int64_t second)
+        {
+            auto windows = keys.find(key);
+            for (size_t window = 0; window < windowCount; window++)
+            {
+                auto totals = windows == keys.end() ? make_pair(0LL, 0.0) : windows->second.getTotals(window, second);
+                if (totals.first + 1 > limits[window].getMaximumCount() || totals.second + amount > limits[window].getMaximumAmount())
+                {
+                    rejectionCounter.add(1);
+                    throw(VelocityLimitExceededException(std::format("The {} may make at most {} transfers, of at most {:.2f} {}, per {}!", owner,
+                                                                     limits[window].getMaximumCount(), limits[window].getMaximumAmount(), limitCurrency,
+                                                                     windowNames[window])));
+                }
+            }
+        }
+        void prune(int64_t second)
+        {
+            auto idleSecond = second - windowLengths.back().count();
+            erase_if(accounts, [idleSecond](const auto &entry)
+                     { return entry.second.getLastSecond() < idleSecond; });
+            erase_if(users, [idleSecond](const auto &entry)
+                     { return entry.second.getLastSecond() < idleSecond; });
+        }
+
+    public:
+        VelocityTracker() {}
+        ~VelocityTracker() {}
+
+        static void setEnabled(bool newEnabled) { enabled = newEnabled; }
+        static void setLimits(array<VelocityLimit, windowCount> newAccountLimits, array<VelocityLimit, windowCount> newUserLimits)
+        {
+            accountLimits = newAccountLimits;
+            userLimits = newUserLimits;
+        }
+
+        static seconds getLongestWindow() { return windowLengths.back(); }
+
+        void clear()
+        {
+            accounts.clear();
+            users.clear();
+        }
+        // throws if the transfer, with the amount in limitCurrency, would take the account or the user over a limit
+        void check(long long accountId, long long userId, double amount, time_point<system_clock> at)
+        {
+            if (!enabled)
+                return;
+            ScopedTimer timer(checkHistogram);
+            auto second = toSecond(at);
+            checkLimits(accounts, accountLimits, "account", accountId, amount, second);
+            checkLimits(users, userLimits, "user", userId, amount, second);
+        }
+        void record(long long accountId, long long userId, double amount, time_point<system_clock> at)
+        {
+            auto second = toSecond(at);
+            accounts[accountId].add(second, amount);
+            users[userId].add(second, amount);
+            if (++recorded % pruneInterval == 0)
+                prune(toSecond(system_clock::now()));
+        }
+    };
+};
\ No newline at end of file